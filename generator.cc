@@ -2,6 +2,7 @@
 #include <set>
 #include <google/protobuf/compiler/code_generator.h>
 #include <google/protobuf/descriptor.h>
+#include <google/protobuf/descriptor.pb.h>
 #include <google/protobuf/io/printer.h>
 #include <google/protobuf/io/zero_copy_stream.h>
 #include "generator.h"
@@ -10,6 +11,7 @@ using google::protobuf::Descriptor;
 using google::protobuf::FieldDescriptor;
 using google::protobuf::FileDescriptor;
 using google::protobuf::MethodDescriptor;
+using google::protobuf::MethodOptions;
 using google::protobuf::ServiceDescriptor;
 using google::protobuf::compiler::CodeGenerator;
 using google::protobuf::compiler::GeneratorContext;
@@ -70,6 +72,50 @@ namespace {
 
     return str;
   }
+
+  std::vector<std::string> splitString
+    ( const std::string&  str
+    , char                delimiter
+    )
+  {
+    std::vector<std::string> parts;
+    std::string::size_type start = 0;
+
+    while(start <= str.length()) {
+      auto end = str.find(delimiter, start);
+
+      if(end == std::string::npos) {
+        end = str.length();
+      }
+
+      if(end > start) {
+        parts.push_back(str.substr(start, end - start));
+      }
+
+      start = end + 1;
+    }
+
+    return parts;
+  }
+
+  bool parseNonNegativeInteger(const std::string& str, int* value) {
+    if(str.empty() || str.length() > 9) {
+      return false;
+    }
+
+    int result = 0;
+
+    for(const char& c : str) {
+      if(!std::isdigit(c)) {
+        return false;
+      }
+
+      result = result * 10 + (c - '0');
+    }
+
+    *value = result;
+    return true;
+  }
 }
 
 namespace {
@@ -80,8 +126,430 @@ namespace {
     IMPROBABLE_ENG = 2
   };
 
+  enum OutputFormat {
+    TYPESCRIPT = 0,
+    JAVASCRIPT = 1,
+    DECLARATIONS = 2
+  };
+
+  struct GeneratorOptions {
+    GrpcWebImplementation grpcWebImpl = GrpcWebImplementation::NONE;
+    OutputFormat outputFormat = OutputFormat::TYPESCRIPT;
+    string grpcWebOutDir;
+    string jsOut;
+    string entityKey;
+    string entityDeleted;
+    vector<string> compressMethods;
+    int compressThreshold = 1024;
+    bool paginate = false;
+    bool loopback = false;
+    bool hedge = false;
+    int hedgeDelay = 0;
+    int hedgeRate = 10;
+    bool schedule = false;
+    vector<string> highPriorityMethods;
+    vector<string> lowPriorityMethods;
+  };
+
+  // Returns true if any of the generated services need the shared runtime
+  // module emitted next to index.ts.
+  bool NeedsAngularRuntime
+    ( const GeneratorOptions&  options
+    )
+  {
+    return !options.entityKey.empty()
+        || !options.compressMethods.empty()
+        || options.paginate
+        || options.loopback
+        || options.hedge
+        || options.schedule;
+  }
+
+  bool ParseGeneratorOptions
+    ( const string&      parameter
+    , GeneratorOptions*  generatorOptions
+    , string*            error
+    )
+  {
+    vector<pair<string, string> > options;
+    bool hasHedgeTuning = false;
+    ParseGeneratorParameter(parameter, &options);
+
+    for(auto keyValue : options) {
+      const auto& key = keyValue.first;
+      const auto& value = keyValue.second;
+
+      if(key == "grpc-web") {
+        if(value == "improbable-eng") {
+          generatorOptions->grpcWebImpl = GrpcWebImplementation::IMPROBABLE_ENG;
+        } else
+        if(value == "google") {
+          generatorOptions->grpcWebImpl = GrpcWebImplementation::GOOGLE;
+        }
+      } else
+      if(key == "grpc-web_out") {
+        generatorOptions->grpcWebOutDir = value;
+      } else
+      if(key == "js_out") {
+        generatorOptions->jsOut = value;
+      } else
+      if(key == "output") {
+        if(value == "ts") {
+          generatorOptions->outputFormat = OutputFormat::TYPESCRIPT;
+        } else
+        if(value == "js") {
+          generatorOptions->outputFormat = OutputFormat::JAVASCRIPT;
+        } else {
+          *error = "options: invalid output value. "
+            "Valid options are 'ts' or 'js'";
+          return false;
+        }
+      } else
+      if(key == "entity_key") {
+        generatorOptions->entityKey = value;
+      } else
+      if(key == "entity_deleted") {
+        generatorOptions->entityDeleted = value;
+      } else
+      if(key == "compress") {
+        generatorOptions->compressMethods = splitString(value, '+');
+      } else
+      if(key == "compress_threshold") {
+        if(!parseNonNegativeInteger(value, &generatorOptions->compressThreshold)) {
+          *error = "options: compress_threshold must be a number of bytes";
+          return false;
+        }
+      } else
+      if(key == "paginate") {
+        generatorOptions->paginate = value != "false";
+      } else
+      if(key == "loopback") {
+        generatorOptions->loopback = value != "false";
+      } else
+      if(key == "hedge") {
+        generatorOptions->hedge = value != "false";
+      } else
+      if(key == "hedge_delay") {
+        hasHedgeTuning = true;
+
+        if(!parseNonNegativeInteger(value, &generatorOptions->hedgeDelay)) {
+          *error = "options: hedge_delay must be a number of milliseconds";
+          return false;
+        }
+      } else
+      if(key == "hedge_rate") {
+        hasHedgeTuning = true;
+
+        if(!parseNonNegativeInteger(value, &generatorOptions->hedgeRate)
+        || generatorOptions->hedgeRate > 100)
+        {
+          *error = "options: hedge_rate must be a percentage";
+          return false;
+        }
+      } else
+      if(key == "schedule") {
+        generatorOptions->schedule = value != "false";
+      } else
+      if(key == "high_priority") {
+        generatorOptions->highPriorityMethods = splitString(value, '+');
+      } else
+      if(key == "low_priority") {
+        generatorOptions->lowPriorityMethods = splitString(value, '+');
+      } else {
+        *error = "Unknown option: " + key;
+        return false;
+      }
+    }
+
+    switch(generatorOptions->grpcWebImpl) {
+      case GrpcWebImplementation::GOOGLE:
+      case GrpcWebImplementation::IMPROBABLE_ENG:
+        break;
+      default:
+        *error = "options: invalid grpc-web value. "
+          "Valid options are 'google' or 'improbable-eng'";
+        return false;
+    }
+
+    if(generatorOptions->grpcWebOutDir.empty()) {
+      *error = "options: grpc-web_out is required";
+      return false;
+    }
+
+    if(generatorOptions->jsOut.empty()) {
+      *error = "options: js_out is required";
+      return false;
+    }
+
+    if(generatorOptions->outputFormat == OutputFormat::JAVASCRIPT
+    && NeedsAngularRuntime(*generatorOptions))
+    {
+      *error = "options: output=js can't be combined with entity_key, "
+        "compress, paginate, loopback, hedge or schedule";
+      return false;
+    }
+
+    if(!generatorOptions->entityDeleted.empty()
+    && generatorOptions->entityKey.empty())
+    {
+      *error = "options: entity_deleted requires entity_key";
+      return false;
+    }
+
+    if(!generatorOptions->schedule
+    && (!generatorOptions->highPriorityMethods.empty()
+     || !generatorOptions->lowPriorityMethods.empty()))
+    {
+      *error = "options: high_priority and low_priority require schedule";
+      return false;
+    }
+
+    if(generatorOptions->hedge
+    && generatorOptions->grpcWebImpl != GrpcWebImplementation::IMPROBABLE_ENG)
+    {
+      *error = "options: hedge requires grpc-web=improbable-eng";
+      return false;
+    }
+
+    if(hasHedgeTuning && !generatorOptions->hedge) {
+      *error = "options: hedge_delay and hedge_rate require hedge";
+      return false;
+    }
+
+    return true;
+  }
+
+  map<string, string> GetImportPrefixVars
+    ( const GeneratorOptions&  options
+    )
+  {
+    string grpcWebOutDir = options.grpcWebOutDir;
+    string jsOut = options.jsOut;
+
+    if(grpcWebOutDir[grpcWebOutDir.size()-1] == '/') {
+      grpcWebOutDir = grpcWebOutDir.substr(1, grpcWebOutDir.size() - 1);
+    }
+
+    if(jsOut[jsOut.size()-1] == '/') {
+      jsOut = jsOut.substr(1, jsOut.size() - 1);
+    }
+
+    map<string, string> vars;
+    vars["grpc_web_import_prefix"] = grpcWebOutDir;
+    vars["web_import_prefix"] = jsOut;
+
+    return vars;
+  }
+
+  // Services route their calls through an injectable GRPC_TRANSPORT once
+  // any feature wraps or replaces the default grpc-web transport.
+  bool NeedsInjectedTransport
+    ( const GeneratorOptions&  options
+    )
+  {
+    return !options.compressMethods.empty()
+        || options.loopback
+        || options.schedule;
+  }
+
+  // Method lists are '+' separated method names. Names may be bare,
+  // qualified with the service name or fully qualified, and '*' matches
+  // every method.
+  bool MethodListContains
+    ( const vector<string>&    methods
+    , const MethodDescriptor&  method
+    )
+  {
+    auto serviceMethodName = method.service()->name() + "." + method.name();
+
+    for(const auto& name : methods) {
+      if(name == "*"
+      || name == method.name()
+      || name == serviceMethodName
+      || name == method.full_name())
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  bool IsCompressedMethod
+    ( const MethodDescriptor&  method
+    , const GeneratorOptions&  options
+    )
+  {
+    if(method.client_streaming()) {
+      return false;
+    }
+
+    return MethodListContains(options.compressMethods, method);
+  }
+
+  string GetTypeScriptFieldType
+    ( const FieldDescriptor&  field
+    )
+  {
+    switch(field.cpp_type()) {
+      case FieldDescriptor::CPPTYPE_STRING:
+        return "string";
+      case FieldDescriptor::CPPTYPE_BOOL:
+        return "boolean";
+      default:
+        return "number";
+    }
+  }
+
+  // Returns the singular scalar field with the given name, if any.
+  const FieldDescriptor* FindScalarField
+    ( const Descriptor&  messageType
+    , const string&      name
+    )
+  {
+    if(name.empty()) {
+      return nullptr;
+    }
+
+    auto field = messageType.FindFieldByName(name);
+
+    if(field == nullptr || field->is_repeated()) {
+      return nullptr;
+    }
+
+    if(field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE) {
+      return nullptr;
+    }
+
+    if(field->type() == FieldDescriptor::TYPE_BYTES) {
+      return nullptr;
+    }
+
+    return field;
+  }
+
+  // The entity key is the singular scalar field named by the entity_key
+  // option. Messages without such a field don't get a store.
+  const FieldDescriptor* FindEntityKeyField
+    ( const Descriptor&         messageType
+    , const GeneratorOptions&   options
+    )
+  {
+    return FindScalarField(messageType, options.entityKey);
+  }
+
+  // Stream messages whose entity_deleted field is set remove their key
+  // from the store instead of upserting it.
+  const FieldDescriptor* FindEntityDeletedField
+    ( const Descriptor&         messageType
+    , const GeneratorOptions&   options
+    )
+  {
+    return FindScalarField(messageType, options.entityDeleted);
+  }
+
+  const Descriptor* GetTopLevelMessage
+    ( const Descriptor&  messageType
+    )
+  {
+    auto topLevelType = &messageType;
+
+    while(topLevelType->containing_type() != nullptr) {
+      topLevelType = topLevelType->containing_type();
+    }
+
+    return topLevelType;
+  }
+
+  // Nested messages are exported as namespaces of their parent message
+  // i.e. Outer.Inner
+  string GetTypeScriptMessageName
+    ( const Descriptor&  messageType
+    )
+  {
+    if(messageType.containing_type() == nullptr) {
+      return messageType.name();
+    }
+
+    return GetTypeScriptMessageName(*messageType.containing_type())
+      + "." + messageType.name();
+  }
+
+  string GetTypeScriptRepeatedItemType
+    ( const FieldDescriptor&  field
+    )
+  {
+    if(field.cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE) {
+      return GetTypeScriptMessageName(*field.message_type());
+    }
+
+    if(field.type() == FieldDescriptor::TYPE_BYTES) {
+      return "string|Uint8Array";
+    }
+
+    return GetTypeScriptFieldType(field);
+  }
+
+  bool HasSingularStringField
+    ( const Descriptor&  messageType
+    , const string&      fieldName
+    )
+  {
+    auto field = messageType.FindFieldByName(fieldName);
+
+    return field != nullptr
+        && !field->is_repeated()
+        && field->type() == FieldDescriptor::TYPE_STRING;
+  }
+
+  // Unary methods following the page_token/next_page_token convention
+  // get paging helpers. The single repeated field of the response holds
+  // the items of a page.
+  const FieldDescriptor* FindPageItemsField
+    ( const MethodDescriptor&  method
+    , const GeneratorOptions&  options
+    )
+  {
+    if(!options.paginate) {
+      return nullptr;
+    }
+
+    if(method.client_streaming() || method.server_streaming()) {
+      return nullptr;
+    }
+
+    auto inputType = method.input_type();
+    auto outputType = method.output_type();
+
+    if(!HasSingularStringField(*inputType, "page_token")
+    || !HasSingularStringField(*outputType, "next_page_token"))
+    {
+      return nullptr;
+    }
+
+    const FieldDescriptor* itemsField = nullptr;
+
+    for(int fieldIndex=0; fieldIndex < outputType->field_count(); ++fieldIndex) {
+      auto field = outputType->field(fieldIndex);
+
+      if(!field->is_repeated() || field->is_map()) {
+        continue;
+      }
+
+      if(itemsField != nullptr) {
+        // Ambiguous, don't guess which field holds the items.
+        return nullptr;
+      }
+
+      itemsField = field;
+    }
+
+    return itemsField;
+  }
+
   map<string, const Descriptor*> GetAllServiceMessages
-    ( const ServiceDescriptor& service
+    ( const ServiceDescriptor&  service
+    , const GeneratorOptions&   options
     )
   {
     map<string, const Descriptor*> messageTypes;
@@ -94,11 +562,105 @@ namespace {
 
       messageTypes[inputType->name()] = inputType;
       messageTypes[outputType->name()] = outputType;
+
+      auto itemsField = FindPageItemsField(*method, options);
+
+      if(itemsField != nullptr && itemsField->message_type() != nullptr) {
+        auto itemType = GetTopLevelMessage(*itemsField->message_type());
+        messageTypes[itemType->name()] = itemType;
+      }
     }
 
     return messageTypes;
   }
 
+  bool HasEntityStore
+    ( const MethodDescriptor&  method
+    , const GeneratorOptions&  options
+    )
+  {
+    return !method.client_streaming()
+        && method.server_streaming()
+        && FindEntityKeyField(*method.output_type(), options) != nullptr;
+  }
+
+  bool IsPagedMethod
+    ( const MethodDescriptor&  method
+    , const GeneratorOptions&  options
+    )
+  {
+    return FindPageItemsField(method, options) != nullptr;
+  }
+
+  bool ServiceHasMethod
+    ( const ServiceDescriptor&  service
+    , const GeneratorOptions&   options
+    , bool (*predicate)(const MethodDescriptor&, const GeneratorOptions&)
+    )
+  {
+    auto methodCount = service.method_count();
+
+    for(int methodIndex=0; methodIndex < methodCount; ++methodIndex) {
+      if(predicate(*service.method(methodIndex), options)) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  string GetMethodPriority
+    ( const MethodDescriptor&  method
+    , const GeneratorOptions&  options
+    )
+  {
+    if(MethodListContains(options.highPriorityMethods, method)) {
+      return "RpcPriority.High";
+    }
+
+    if(MethodListContains(options.lowPriorityMethods, method)) {
+      return "RpcPriority.Low";
+    }
+
+    return "RpcPriority.Normal";
+  }
+
+  string GetMethodTransport
+    ( const MethodDescriptor&  method
+    , const GeneratorOptions&  options
+    )
+  {
+    string transport;
+
+    if(IsCompressedMethod(method, options)) {
+      transport = "this._gzipTransport";
+    } else
+    if(NeedsInjectedTransport(options)) {
+      transport = "this._transport";
+    }
+
+    if(options.schedule) {
+      return "this._scheduler.transport("
+        + GetMethodPriority(method, options) + ", " + transport + ")";
+    }
+
+    return transport;
+  }
+
+  // Hedging sends a second copy of slow calls, so it's limited to unary
+  // methods declared free of side effects.
+  bool IsHedgedMethod
+    ( const MethodDescriptor&  method
+    , const GeneratorOptions&  options
+    )
+  {
+    return options.hedge
+        && options.grpcWebImpl == GrpcWebImplementation::IMPROBABLE_ENG
+        && !method.client_streaming()
+        && !method.server_streaming()
+        && method.options().idempotency_level() == MethodOptions::NO_SIDE_EFFECTS;
+  }
+
   void PrintAngularServiceGoogleUnaryCall
     ( map<string, string>  vars
     , Printer&             printer
@@ -117,15 +679,22 @@ namespace {
     )
   {
 
-    printer.Print(vars, "let responseMetadata: grpc.Metadata = null;\n\n");
+    printer.Print(vars, "let responseMetadata$metadata_annotation$ = null;\n\n");
 
-    printer.Print(vars, "grpc.invoke(__service.$Method_name$, {\n");
+    printer.Print(vars, "let req = grpc.invoke(__service.$Method_name$, {\n");
     printer.Indent();
 
     printer.Print(vars,
       "request: request,\n"
-      "host: (<any>window).DEFAULT_ANGULAR_GRPC_HOST || 'https://' + location.hostname,\n"
+      "host: $window$.DEFAULT_ANGULAR_GRPC_HOST || 'https://' + location.hostname,\n"
       "metadata: metadata,\n"
+    );
+
+    if(!vars["transport"].empty()) {
+      printer.Print(vars, "transport: $transport$,\n");
+    }
+
+    printer.Print(vars,
       "onHeaders: headers => responseMetadata = headers,\n"
       "onMessage: response => this._ngZone.run(() => {\n"
       "  callback(null, response, responseMetadata || new grpc.Metadata());\n"
@@ -141,39 +710,97 @@ namespace {
     printer.Print("});\n\n");
   }
 
-  void PrintAngularServiceGoogleServerStreamingCall
+  void PrintAngularServiceImprobableEngHedgedUnaryCall
     ( map<string, string>  vars
     , Printer&             printer
     )
   {
+    if(!vars["transport"].empty()) {
+      printer.Print(vars, "let transport = $transport$;\n\n");
+      vars["transport"] = "transport";
+    }
 
-  }
+    printer.Print(vars, "let req = this.$hedge_policy$.invoke(done => {\n");
+    printer.Indent();
 
-  void PrintAngularServiceImprobableEngServerStreamingCall
-    ( map<string, string>  vars
-    , Printer&             printer
-    )
-  {
-    printer.Print(vars, "let req = grpc.invoke(__service.$Method_name$, {\n");
+    printer.Print(vars, "let responseMetadata$metadata_annotation$ = null;\n\n");
+
+    printer.Print(vars, "return grpc.invoke(__service.$Method_name$, {\n");
     printer.Indent();
 
     printer.Print(vars,
       "request: request,\n"
-      "host: (<any>window).DEFAULT_ANGULAR_GRPC_HOST || 'https://' + location.hostname,\n"
+      "host: $window$.DEFAULT_ANGULAR_GRPC_HOST || 'https://' + location.hostname,\n"
       "metadata: metadata,\n"
-      "onMessage: response => this._ngZone.run(() => {\n"
-      "  onMessage(response);\n"
-      "}),\n"
-      "onEnd: (code, msg, metadata) => this._ngZone.run(() => {\n"
-      "  if(code == grpc.Code.OK) {\n"
-      "    onEnd(code, msg, metadata);\n"
-      "  } else {\n"
-      "    onError(new Error(code + ' ' + (msg||'')));\n"
-      "  }\n"
-      "})\n"
     );
 
-    printer.Outdent();
+    if(!vars["transport"].empty()) {
+      printer.Print(vars, "transport: $transport$,\n");
+    }
+
+    printer.Print(vars,
+      "onHeaders: headers => responseMetadata = headers,\n"
+      "onMessage: response => {\n"
+      "  done(null, response, responseMetadata || new grpc.Metadata());\n"
+      "},\n"
+      "onEnd: (code, msg, metadata) => {\n"
+      "  if(code != grpc.Code.OK) {\n"
+      "    done(new Error(msg));\n"
+      "  }\n"
+      "}\n"
+    );
+
+    printer.Outdent();
+    printer.Print("});\n");
+
+    printer.Outdent();
+    printer.Print(
+      "}, (err, response, responseMetadata) => this._ngZone.run(() => {\n"
+      "  callback(err, response, responseMetadata);\n"
+      "}));\n\n"
+    );
+  }
+
+  void PrintAngularServiceGoogleServerStreamingCall
+    ( map<string, string>  vars
+    , Printer&             printer
+    )
+  {
+
+  }
+
+  void PrintAngularServiceImprobableEngServerStreamingCall
+    ( map<string, string>  vars
+    , Printer&             printer
+    )
+  {
+    printer.Print(vars, "let req = grpc.invoke(__service.$Method_name$, {\n");
+    printer.Indent();
+
+    printer.Print(vars,
+      "request: request,\n"
+      "host: $window$.DEFAULT_ANGULAR_GRPC_HOST || 'https://' + location.hostname,\n"
+      "metadata: metadata,\n"
+    );
+
+    if(!vars["transport"].empty()) {
+      printer.Print(vars, "transport: $transport$,\n");
+    }
+
+    printer.Print(vars,
+      "onMessage: response => this._ngZone.run(() => {\n"
+      "  onMessage(response);\n"
+      "}),\n"
+      "onEnd: (code, msg, metadata) => this._ngZone.run(() => {\n"
+      "  if(code == grpc.Code.OK) {\n"
+      "    onEnd(code, msg, metadata);\n"
+      "  } else {\n"
+      "    onError(new Error(code + ' ' + (msg||'')));\n"
+      "  }\n"
+      "})\n"
+    );
+
+    printer.Outdent();
     printer.Print("});\n\n");
   }
 
@@ -181,7 +808,7 @@ namespace {
     ( map<string, string>           vars
     , Printer&                      printer
     , const MethodDescriptor&       method
-    , const GrpcWebImplementation&  grpcWebImpl
+    , const GeneratorOptions&       options
     )
   {
 
@@ -193,6 +820,12 @@ namespace {
     vars["input_type"] = inputType->name();
     vars["output_type"] = outputType->name();
 
+    vars["transport"] = GetMethodTransport(method, options);
+    vars["output_type_args"] =
+      options.outputFormat == OutputFormat::JAVASCRIPT
+        ? ""
+        : "<" + outputType->name() + ">";
+
     printer.Print("let ret, callback, metadata;\n\n");
 
     printer.Print(
@@ -207,7 +840,7 @@ namespace {
     printer.Print("if(!callback) {\n");
     printer.Indent();
 
-    printer.Print(vars, "ret = new Promise<$output_type$>"
+    printer.Print(vars, "ret = new Promise$output_type_args$"
       "((resolve, reject) => {\n");
     printer.Indent();
 
@@ -226,23 +859,30 @@ namespace {
     printer.Outdent();
     printer.Print("}\n\n");
 
-    switch(grpcWebImpl) {
+    if(IsHedgedMethod(method, options)) {
+      vars["hedge_policy"] = "_" + firstCharToLower(method.name()) + "Hedge";
+      PrintAngularServiceImprobableEngHedgedUnaryCall(vars, printer);
+      printer.Print("return ret || req;\n");
+      return;
+    }
+
+    switch(options.grpcWebImpl) {
       case GrpcWebImplementation::IMPROBABLE_ENG:
         PrintAngularServiceImprobableEngUnaryCall(vars, printer);
+        printer.Print("return ret || req;\n");
         break;
       case GrpcWebImplementation::GOOGLE:
         PrintAngularServiceGoogleUnaryCall(vars, printer);
+        printer.Print("return ret || { close: () => {} };\n");
         break;
     }
-
-    printer.Print("return ret;\n");
   }
 
   void PrintAngularServiceServerStreamingMethodBody
     ( map<string, string>           vars
     , Printer&                      printer
     , const MethodDescriptor&       method
-    , const GrpcWebImplementation&  grpcWebImpl
+    , const GeneratorOptions&       options
     )
   {
     auto inputType = method.input_type();
@@ -253,6 +893,12 @@ namespace {
     vars["input_type"] = inputType->name();
     vars["output_type"] = outputType->name();
 
+    vars["transport"] = GetMethodTransport(method, options);
+    vars["output_type_args"] =
+      options.outputFormat == OutputFormat::JAVASCRIPT
+        ? ""
+        : "<" + outputType->name() + ">";
+
     printer.Print("let ret, metadata, onMessage, onError, onEnd;\n\n");
 
     printer.Print(
@@ -272,7 +918,7 @@ namespace {
 
     printer.Print(vars,
       "if(!onMessage) {\n"
-      "  let subject = new Subject<$output_type$>();\n"
+      "  let subject = new Subject$output_type_args$();\n"
       "  ret = subject.asObservable();\n\n"
       "  onMessage = (response) => {\n"
       "    subject.next(response);\n"
@@ -293,7 +939,7 @@ namespace {
       "}\n\n"
     );
 
-    switch(grpcWebImpl) {
+    switch(options.grpcWebImpl) {
       case GrpcWebImplementation::GOOGLE:
         PrintAngularServiceGoogleServerStreamingCall(vars, printer);
         break;
@@ -311,7 +957,7 @@ namespace {
     ( map<string, string>           vars
     , Printer&                      printer
     , const MethodDescriptor&       method
-    , const GrpcWebImplementation&  grpcWebImpl
+    , const GeneratorOptions&       options
     )
   {
     auto inputType = method.input_type();
@@ -324,6 +970,18 @@ namespace {
     vars["cb_signature"] =
       "(err: any|null, response: " + outputType->name() + ", metadata: grpc.Metadata) => void";
 
+    if(options.outputFormat == OutputFormat::JAVASCRIPT) {
+      printer.Print(vars, "$method_name$(request, arg1, arg2) {\n");
+      printer.Indent();
+
+      PrintAngularServiceUnaryMethodBody(vars, printer, method, options);
+
+      printer.Outdent();
+
+      printer.Print("}\n\n");
+      return;
+    }
+
     // A few signatures
     printer.Print(vars,
       "$method_name$("
@@ -342,7 +1000,7 @@ namespace {
       "$method_name$("
         "request: $input_type$, "
         "callback: $cb_signature$"
-      "): void;\n"
+      "): {close():void};\n"
     );
 
     printer.Print(vars,
@@ -350,20 +1008,24 @@ namespace {
         "request: $input_type$, "
         "metadata: grpc.Metadata, "
         "callback: $cb_signature$"
-      "): void;\n\n"
+      "): {close():void};\n\n"
     );
 
+    if(options.outputFormat == OutputFormat::DECLARATIONS) {
+      return;
+    }
+
     printer.Print(vars,
       "$method_name$("
         "request: $input_type$, "
         "arg1?: grpc.Metadata|($cb_signature$), "
         "arg2?: $cb_signature$"
-      "): Promise<$output_type$>|void {\n"
+      "): Promise<$output_type$>|{close():void} {\n"
     );
 
     printer.Indent();
 
-    PrintAngularServiceUnaryMethodBody(vars, printer, method, grpcWebImpl);
+    PrintAngularServiceUnaryMethodBody(vars, printer, method, options);
 
     printer.Outdent();
 
@@ -374,215 +1036,2129 @@ namespace {
     ( map<string, string>           vars
     , Printer&                      printer
     , const MethodDescriptor&       method
-    , const GrpcWebImplementation&  grpcWebImpl
+    , const GeneratorOptions&       options
+    )
+  {
+
+  }
+
+  void PrintAngularServiceClientStreamingMethod
+    ( map<string, string>           vars
+    , Printer&                      printer
+    , const MethodDescriptor&       method
+    , const GeneratorOptions&       options
+    )
+  {
+
+  }
+  
+  void PrintAngularServiceServerStreamingMethod
+    ( map<string, string>           vars
+    , Printer&                      printer
+    , const MethodDescriptor&       method
+    , const GeneratorOptions&       options
+    )
+  {
+    auto inputType = method.input_type();
+    auto outputType = method.output_type();
+
+    vars["method_name"] = firstCharToLower(method.name());
+    vars["Method_name"] = method.name();
+    vars["input_type"] = inputType->name();
+    vars["output_type"] = outputType->name();
+    vars["msg_cb"] =
+      "(message?: " + outputType->name() + ") => void";
+    vars["error_cb"] = "(err) => void";
+    vars["end_cb"] = "("
+      "code: grpc.Code, "
+      "msg: string|undefined, "
+      "metadata: grpc.Metadata"
+    ") => void";
+
+    if(options.outputFormat == OutputFormat::JAVASCRIPT) {
+      printer.Print(vars,
+        "$method_name$(request, arg1, arg2, arg3, arg4) {\n");
+      printer.Indent();
+
+      PrintAngularServiceServerStreamingMethodBody(
+        vars, printer, method, options
+      );
+
+      printer.Outdent();
+
+      printer.Print("}\n\n");
+      return;
+    }
+
+    // A few signatures
+    printer.Print(vars,
+      "$method_name$("
+        "request: $input_type$"
+      "): {close():void}&Observable<$output_type$>;\n"
+    );
+
+    printer.Print(vars,
+      "$method_name$("
+        "request: $input_type$, "
+        "metadata: grpc.Metadata"
+      "): {close():void}&Observable<$output_type$>;\n"
+    );
+    
+    printer.Print(vars,
+      "$method_name$("
+        "request: $input_type$, "
+        "onMessage: $msg_cb$,"
+        "onError?: $error_cb$,"
+        "onEnd?: $end_cb$"
+      "): void;\n"
+    );
+
+    printer.Print(vars,
+      "$method_name$("
+        "request: $input_type$, "
+        "metadata: grpc.Metadata, "
+        "onMessage: $msg_cb$,"
+        "onError?: $error_cb$,"
+        "onEnd?: $end_cb$"
+      "): void;\n\n"
+    );
+
+    if(options.outputFormat == OutputFormat::DECLARATIONS) {
+      return;
+    }
+
+    printer.Print(vars,
+      "$method_name$("
+        "request: $input_type$, "
+        "arg1?: grpc.Metadata|($msg_cb$), "
+        "arg2?: ($msg_cb$)|($error_cb$), "
+        "arg3?: ($error_cb$)|($end_cb$), "
+        "arg4?: $end_cb$"
+      "): {close():void}&Observable<$output_type$>|void {\n"
+    );
+
+    printer.Indent();
+
+    PrintAngularServiceServerStreamingMethodBody(
+      vars, printer, method, options
+    );
+
+    printer.Outdent();
+
+    printer.Print("}\n\n");
+  }
+
+  void SetServiceImportVars
+    ( map<string, string>&          vars
+    , const ServiceDescriptor&      service
+    )
+  {
+    string filename = service.file()->name();
+    filename = filename.substr(0, filename.size() - 6);
+
+    vars["service_name"] = service.name();
+    vars["service_import"] = filename + "_pb_service";
+    vars["file_import_prefix"] = getImportPrefix(filename);
+  }
+
+  void PrintAngularServiceTypeImports
+    ( map<string, string>           vars
+    , Printer&                      printer
+    , const ServiceDescriptor&      service
+    , const GeneratorOptions&       options
+    )
+  {
+    SetServiceImportVars(vars, service);
+
+    auto importTypes = GetAllServiceMessages(service, options);
+
+    for(auto pair : importTypes) {
+      map<string, string> importVars{vars};
+      auto importName = pair.first;
+      auto importType = pair.second;
+      string filename = importType->file()->name();
+      filename = filename.substr(0, filename.size() - 6);
+
+      importVars["import_name"] = importName;
+      importVars["type_import"] = filename + "_pb";
+
+      printer.Print(importVars,
+        "import { $import_name$ } from '$file_import_prefix$$web_import_prefix$/$type_import$';\n");
+    }
+
+    printer.Print("\n");
+  }
+
+  void PrintAngularServiceDefinitionImport
+    ( map<string, string>           vars
+    , Printer&                      printer
+    , const ServiceDescriptor&      service
+    )
+  {
+    SetServiceImportVars(vars, service);
+
+    printer.Print(vars,
+      "import { $service_name$ as __service } from '$file_import_prefix$$grpc_web_import_prefix$/$service_import$';\n\n");
+  }
+
+  void PrintAngularServiceMessageImports
+    ( map<string, string>           vars
+    , Printer&                      printer
+    , const ServiceDescriptor&      service
+    , const GeneratorOptions&       options
+    )
+  {
+    PrintAngularServiceTypeImports(vars, printer, service, options);
+    PrintAngularServiceDefinitionImport(vars, printer, service);
+  }
+
+  // Handler interface and registration function serving a service from a
+  // LoopbackServer, for tests and benchmarks without a backend.
+  void PrintAngularServiceLoopback
+    ( map<string, string>           vars
+    , Printer&                      printer
+    , const ServiceDescriptor&      service
+    , const GeneratorOptions&       options
     )
   {
+    vars["service_name"] = service.name();
+
+    printer.Print("import { grpc } from 'grpc-web-client';\n\n");
+
+    PrintAngularServiceMessageImports(vars, printer, service, options);
+
+    printer.Print("import { LoopbackServer } from './runtime';\n\n");
+
+    auto methodCount = service.method_count();
+
+    printer.Print(vars, "export interface $service_name$LoopbackHandlers {\n");
+    printer.Indent();
+
+    for(auto i=0; methodCount > i; ++i) {
+      auto method = service.method(i);
+
+      if(method->client_streaming()) {
+        continue;
+      }
+
+      map<string, string> methodVars{vars};
+      methodVars["method_name"] = firstCharToLower(method->name());
+      methodVars["input_type"] = method->input_type()->name();
+      methodVars["output_type"] = method->output_type()->name();
+
+      if(method->server_streaming()) {
+        printer.Print(methodVars,
+          "$method_name$("
+            "request: $input_type$, "
+            "metadata: grpc.Metadata, "
+            "send: (response: $output_type$) => void"
+          "): void|Promise<void>;\n"
+        );
+      } else {
+        printer.Print(methodVars,
+          "$method_name$("
+            "request: $input_type$, "
+            "metadata: grpc.Metadata"
+          "): $output_type$|Promise<$output_type$>;\n"
+        );
+      }
+    }
+
+    printer.Outdent();
+    printer.Print("}\n\n");
+
+    printer.Print(vars,
+      "export function serve$service_name$Loopback("
+        "server: LoopbackServer, "
+        "handlers: $service_name$LoopbackHandlers"
+      "): void {\n"
+    );
+    printer.Indent();
+
+    for(auto i=0; methodCount > i; ++i) {
+      auto method = service.method(i);
+
+      if(method->client_streaming()) {
+        continue;
+      }
+
+      map<string, string> methodVars{vars};
+      methodVars["method_name"] = firstCharToLower(method->name());
+      methodVars["Method_name"] = method->name();
+      methodVars["input_type"] = method->input_type()->name();
+      methodVars["output_type"] = method->output_type()->name();
+
+      if(method->server_streaming()) {
+        printer.Print(methodVars,
+          "server.handle(__service.$Method_name$, ("
+            "request: $input_type$, "
+            "metadata: grpc.Metadata, "
+            "send: (response: $output_type$) => void"
+          ") =>\n"
+          "  handlers.$method_name$(request, metadata, send));\n"
+        );
+      } else {
+        printer.Print(methodVars,
+          "server.handle(__service.$Method_name$, ("
+            "request: $input_type$, "
+            "metadata: grpc.Metadata"
+          ") =>\n"
+          "  handlers.$method_name$(request, metadata));\n"
+        );
+      }
+    }
+
+    printer.Outdent();
+    printer.Print("}\n");
+  }
+
+  void PrintAngularServiceEntityStoreMethod
+    ( map<string, string>           vars
+    , Printer&                      printer
+    , const MethodDescriptor&       method
+    , const FieldDescriptor&        keyField
+    , const FieldDescriptor*        deletedField
+    )
+  {
+    auto inputType = method.input_type();
+    auto outputType = method.output_type();
+
+    vars["method_name"] = firstCharToLower(method.name());
+    vars["input_type"] = inputType->name();
+    vars["output_type"] = outputType->name();
+    vars["key_type"] = GetTypeScriptFieldType(keyField);
+    vars["key_getter"] = "get" + firstCharToUpper(keyField.camelcase_name());
+
+    printer.Print(vars,
+      "$method_name$Store("
+        "request: $input_type$, "
+        "metadata?: grpc.Metadata"
+      "): EntityStore<$key_type$, $output_type$> {\n"
+    );
+
+    printer.Indent();
+
+    printer.Print(vars,
+      "let store = new EntityStore<$key_type$, $output_type$>"
+        "(entity => entity.$key_getter$());\n"
+      "let stream = this.$method_name$(request, metadata);\n"
+      "let subscription = stream.subscribe(\n"
+    );
+
+    if(deletedField != nullptr) {
+      vars["deleted_getter"] =
+        "get" + firstCharToUpper(deletedField->camelcase_name());
+
+      printer.Print(vars,
+        "  entity => entity.$deleted_getter$()\n"
+        "    ? store.remove(entity.$key_getter$())\n"
+        "    : store.upsert(entity),\n"
+      );
+    } else {
+      printer.Print("  entity => store.upsert(entity),\n");
+    }
+
+    printer.Print(vars,
+      "  err => store.error(err),\n"
+      "  () => store.complete()\n"
+      ");\n\n"
+      "store.close = () => {\n"
+      "  subscription.unsubscribe();\n"
+      "  stream.close();\n"
+      "};\n\n"
+      "return store;\n"
+    );
+
+    printer.Outdent();
+
+    printer.Print("}\n\n");
+  }
+
+  void PrintAngularServicePagedMethods
+    ( map<string, string>           vars
+    , Printer&                      printer
+    , const MethodDescriptor&       method
+    , const FieldDescriptor&        itemsField
+    , const GeneratorOptions&       options
+    )
+  {
+    auto inputType = method.input_type();
+
+    vars["method_name"] = firstCharToLower(method.name());
+    vars["input_type"] = inputType->name();
+    vars["item_type"] = GetTypeScriptRepeatedItemType(itemsField);
+    vars["items_getter"] =
+      "get" + firstCharToUpper(itemsField.camelcase_name()) + "List";
+
+    printer.Print(vars,
+      "$method_name$Pages("
+        "request: $input_type$, "
+        "metadata?: grpc.Metadata, "
+        "prefetch: number = 1"
+      "): PageIterator<$item_type$> {\n"
+    );
+
+    printer.Indent();
+
+    if(options.schedule) {
+      // Pages after the first are requested asynchronously, outside of
+      // any withPriority() the caller used.
+      printer.Print(vars,
+        "let priority = this._scheduler.currentPriority();\n\n"
+        "return new PageIterator<$item_type$>((pageToken, callback) => {\n"
+        "  let pageRequest = <$input_type$>request.cloneMessage();\n"
+        "  pageRequest.setPageToken(pageToken);\n\n"
+        "  return this._scheduler.withPriority(priority, () =>\n"
+        "    this.$method_name$(pageRequest, metadata, (err, response) => {\n"
+        "      callback(err, err ? null : {\n"
+        "        items: response.$items_getter$(),\n"
+        "        nextPageToken: response.getNextPageToken()\n"
+        "      });\n"
+        "    })\n"
+        "  );\n"
+        "}, request.getPageToken(), prefetch);\n"
+      );
+    } else {
+      printer.Print(vars,
+        "return new PageIterator<$item_type$>((pageToken, callback) => {\n"
+        "  let pageRequest = <$input_type$>request.cloneMessage();\n"
+        "  pageRequest.setPageToken(pageToken);\n\n"
+        "  return this.$method_name$(pageRequest, metadata, (err, response) => {\n"
+        "    callback(err, err ? null : {\n"
+        "      items: response.$items_getter$(),\n"
+        "      nextPageToken: response.getNextPageToken()\n"
+        "    });\n"
+        "  });\n"
+        "}, request.getPageToken(), prefetch);\n"
+      );
+    }
+
+    printer.Outdent();
+
+    printer.Print("}\n\n");
+
+    printer.Print(vars,
+      "$method_name$All("
+        "request: $input_type$, "
+        "metadata?: grpc.Metadata, "
+        "prefetch: number = 1"
+      "): Observable<$item_type$> {\n"
+    );
+
+    if(options.schedule) {
+      printer.Print(vars,
+        "  let priority = this._scheduler.currentPriority();\n\n"
+        "  return pagedObservable(() => "
+          "this._scheduler.withPriority(priority, () =>\n"
+        "    this.$method_name$Pages(request, metadata, prefetch)));\n"
+        "}\n\n"
+      );
+    } else {
+      printer.Print(vars,
+        "  return pagedObservable(() => "
+          "this.$method_name$Pages(request, metadata, prefetch));\n"
+        "}\n\n"
+      );
+    }
+  }
+
+  void PrintAngularServiceMethods
+    ( map<string, string>           vars
+    , Printer&                      printer
+    , const ServiceDescriptor&      service
+    , const GeneratorOptions&       options
+    )
+  {
+    auto methodCount = service.method_count();
+
+    for(auto i=0; methodCount > i; ++i) {
+      auto method = service.method(i);
+
+      if(!method->client_streaming() && !method->server_streaming()) {
+        PrintAngularServiceUnaryMethod(vars, printer, *method, options);
+      } else
+      if(method->client_streaming() && method->server_streaming()) {
+        PrintAngularServiceBidiStreamingMethod(vars, printer, *method, options);
+      } else
+      if(method->client_streaming()) {
+        PrintAngularServiceClientStreamingMethod(vars, printer, *method, options);
+      } else
+      if(method->server_streaming()) {
+        PrintAngularServiceServerStreamingMethod(vars, printer, *method, options);
+      }
+    }
+  }
+
+  // Same service as the TypeScript output, with decorators and
+  // constructor parameters lowered to the static properties Angular reads
+  // at runtime.
+  void PrintAngularServiceJs
+    ( map<string, string>           vars
+    , Printer&                      printer
+    , const ServiceDescriptor&      service
+    , const GeneratorOptions&       options
+    )
+  {
+    vars["service_name"] = service.name();
+
+    printer.Print("import { Injectable, NgZone } from '@angular/core';\n");
+    printer.Print("import { Subject } from 'rxjs';\n");
+    printer.Print("import { grpc } from 'grpc-web-client';\n\n");
+
+    PrintAngularServiceDefinitionImport(vars, printer, service);
+
+    printer.Print(vars, "export class $service_name$ {\n\n");
+
+    printer.Indent();
+
+    printer.Print(
+      "constructor(_ngZone) {\n"
+      "  this._ngZone = _ngZone;\n"
+      "}\n\n"
+    );
+
+    PrintAngularServiceMethods(vars, printer, service, options);
+
+    printer.Outdent();
+
+    printer.Print("}\n\n");
+
+    printer.Print(vars,
+      "$service_name$.decorators = [\n"
+      "  { type: Injectable }\n"
+      "];\n\n"
+      "$service_name$.ctorParameters = () => [\n"
+      "  { type: NgZone }\n"
+      "];\n"
+    );
+  }
+
+  void PrintAngularServiceDeclarations
+    ( map<string, string>           vars
+    , Printer&                      printer
+    , const ServiceDescriptor&      service
+    , const GeneratorOptions&       options
+    )
+  {
+    printer.Print("import { NgZone } from '@angular/core';\n");
+    printer.Print("import { Observable } from 'rxjs';\n");
+    printer.Print("import { grpc } from 'grpc-web-client';\n\n");
+
+    PrintAngularServiceTypeImports(vars, printer, service, options);
+
+    printer.Print(("export declare class " + service.name() + " {\n\n").c_str());
+
+    printer.Indent();
+
+    printer.Print(
+      "private _ngZone;\n"
+      "constructor(_ngZone: NgZone);\n\n"
+    );
+
+    PrintAngularServiceMethods(vars, printer, service, options);
+
+    printer.Outdent();
+
+    printer.Print("}\n");
+  }
+
+  // Metadata read by the Angular AOT compiler in place of the decorators
+  // of the TypeScript sources.
+  void PrintAngularServiceMetadata
+    ( Printer&                      printer
+    , const ServiceDescriptor&      service
+    )
+  {
+    map<string, string> vars;
+    vars["service_name"] = service.name();
+
+    printer.Print(vars,
+      "{\n"
+      "  \"__symbolic\": \"module\",\n"
+      "  \"version\": 4,\n"
+      "  \"metadata\": {\n"
+      "    \"$service_name$\": {\n"
+      "      \"__symbolic\": \"class\",\n"
+      "      \"decorators\": [\n"
+      "        {\n"
+      "          \"__symbolic\": \"call\",\n"
+      "          \"expression\": {\n"
+      "            \"__symbolic\": \"reference\",\n"
+      "            \"module\": \"@angular/core\",\n"
+      "            \"name\": \"Injectable\"\n"
+      "          }\n"
+      "        }\n"
+      "      ],\n"
+      "      \"members\": {\n"
+      "        \"__ctor__\": [\n"
+      "          {\n"
+      "            \"__symbolic\": \"constructor\",\n"
+      "            \"parameters\": [\n"
+      "              {\n"
+      "                \"__symbolic\": \"reference\",\n"
+      "                \"module\": \"@angular/core\",\n"
+      "                \"name\": \"NgZone\"\n"
+      "              }\n"
+      "            ]\n"
+      "          }\n"
+      "        ]\n"
+      "      }\n"
+      "    }\n"
+      "  }\n"
+      "}\n"
+    );
+  }
+
+  // Prints a single import of the given names from the runtime module,
+  // wrapped one name per line when it doesn't fit on one.
+  void PrintAngularRuntimeImport
+    ( Printer&               printer
+    , const vector<string>&  names
+    )
+  {
+    if(names.empty()) {
+      return;
+    }
+
+    string singleLine;
+
+    for(const auto& name : names) {
+      singleLine += (singleLine.empty() ? "" : ", ") + name;
+    }
+
+    singleLine = "import { " + singleLine + " } from './runtime';\n\n";
+
+    if(singleLine.size() <= 81) {
+      printer.Print(singleLine.c_str());
+      return;
+    }
+
+    printer.Print("import {\n");
+    printer.Indent();
+
+    for(size_t i=0; names.size() > i; ++i) {
+      map<string, string> vars;
+      vars["name"] = names[i];
+      vars["separator"] = i + 1 < names.size() ? "," : "";
+
+      printer.Print(vars, "$name$$separator$\n");
+    }
+
+    printer.Outdent();
+    printer.Print("} from './runtime';\n\n");
+  }
+
+  void PrintAngularService
+    ( map<string, string>           vars
+    , Printer&                      printer
+    , const ServiceDescriptor&      service
+    , const GeneratorOptions&       options
+    )
+  {
+    vars["compress_threshold"] = std::to_string(options.compressThreshold);
+    vars["window"] = "(<any>window)";
+    vars["metadata_annotation"] = ": grpc.Metadata";
+
+    if(options.outputFormat == OutputFormat::JAVASCRIPT) {
+      vars["window"] = "window";
+      vars["metadata_annotation"] = "";
+
+      PrintAngularServiceJs(vars, printer, service, options);
+      return;
+    }
+
+    if(options.outputFormat == OutputFormat::DECLARATIONS) {
+      PrintAngularServiceDeclarations(vars, printer, service, options);
+      return;
+    }
+
+    if(NeedsInjectedTransport(options)) {
+      printer.Print(
+        "import { Inject, Injectable, NgZone, Optional } from '@angular/core';\n");
+    } else {
+      printer.Print("import { Injectable, NgZone } from '@angular/core';\n");
+    }
+
+    printer.Print("import { Observable } from 'rxjs';\n");
+    printer.Print("import { Subject } from 'rxjs';\n");
+    printer.Print("import { grpc } from 'grpc-web-client';\n\n");
+
+    PrintAngularServiceMessageImports(vars, printer, service, options);
+
+    bool hasCompressedMethod =
+      ServiceHasMethod(service, options, &IsCompressedMethod);
+    bool hasHedgedMethod = ServiceHasMethod(service, options, &IsHedgedMethod);
+    vector<string> runtimeImports;
+
+    if(ServiceHasMethod(service, options, &HasEntityStore)) {
+      runtimeImports.push_back("EntityStore");
+    }
+
+    if(ServiceHasMethod(service, options, &IsPagedMethod)) {
+      runtimeImports.push_back("PageIterator");
+      runtimeImports.push_back("pagedObservable");
+    }
+
+    if(hasHedgedMethod) {
+      runtimeImports.push_back("HedgePolicy");
+    }
+
+    if(NeedsInjectedTransport(options)) {
+      runtimeImports.push_back("GRPC_TRANSPORT");
+      runtimeImports.push_back("GrpcTransportFactory");
+      runtimeImports.push_back("defaultGrpcTransport");
+
+      if(hasCompressedMethod) {
+        runtimeImports.push_back("gzipTransport");
+      }
+
+      if(options.schedule) {
+        runtimeImports.push_back("RPC_SCHEDULER");
+        runtimeImports.push_back("RpcPriority");
+        runtimeImports.push_back("RpcScheduler");
+        runtimeImports.push_back("defaultRpcScheduler");
+      }
+    }
+
+    PrintAngularRuntimeImport(printer, runtimeImports);
+
+    printer.Print("@Injectable()\n");
+    printer.Print(("export class " + service.name() + " {\n\n").c_str());
+
+    printer.Indent();
+
+    if(hasHedgedMethod) {
+      map<string, string> hedgeVars;
+      hedgeVars["hedge_delay"] = std::to_string(options.hedgeDelay);
+      hedgeVars["hedge_rate"] = std::to_string(options.hedgeRate);
+
+      for(auto i=0; service.method_count() > i; ++i) {
+        auto method = service.method(i);
+
+        if(IsHedgedMethod(*method, options)) {
+          hedgeVars["method_name"] = firstCharToLower(method->name());
+          printer.Print(hedgeVars,
+            "private _$method_name$Hedge = "
+              "new HedgePolicy($hedge_delay$, $hedge_rate$);\n");
+        }
+      }
+
+      printer.Print("\n");
+    }
+
+    if(NeedsInjectedTransport(options)) {
+      printer.Print("private _transport: GrpcTransportFactory;\n");
+
+      if(hasCompressedMethod) {
+        printer.Print("private _gzipTransport: GrpcTransportFactory;\n");
+      }
+
+      if(options.schedule) {
+        printer.Print("private _scheduler: RpcScheduler;\n");
+      }
+
+      printer.Print(
+        "\n"
+        "constructor(\n"
+        "  private _ngZone: NgZone,\n"
+      );
+
+      if(options.schedule) {
+        printer.Print(
+          "  @Optional() @Inject(GRPC_TRANSPORT) transport: GrpcTransportFactory,\n"
+          "  @Optional() @Inject(RPC_SCHEDULER) scheduler?: RpcScheduler\n"
+        );
+      } else {
+        printer.Print(
+          "  @Optional() @Inject(GRPC_TRANSPORT) transport: GrpcTransportFactory\n"
+        );
+      }
+
+      printer.Print(
+        ") {\n"
+        "  this._transport = transport || defaultGrpcTransport();\n"
+      );
+
+      if(options.schedule) {
+        printer.Print(
+          "  this._scheduler = scheduler || defaultRpcScheduler();\n");
+      }
+
+      if(hasCompressedMethod) {
+        printer.Print(vars,
+          "  this._gzipTransport = "
+            "gzipTransport($compress_threshold$, this._transport);\n");
+      }
+
+      printer.Print("}\n\n");
+    } else {
+      printer.Print(
+        "constructor("
+          "private _ngZone: NgZone"
+        ") {}\n\n"
+      );
+    }
+
+    auto methodCount = service.method_count();
+
+    for(auto i=0; methodCount > i; ++i) {
+      auto method = service.method(i);
+
+      if(!method->client_streaming() && !method->server_streaming()) {
+        PrintAngularServiceUnaryMethod(vars, printer, *method, options);
+
+        auto itemsField = FindPageItemsField(*method, options);
+
+        if(itemsField != nullptr) {
+          PrintAngularServicePagedMethods(
+            vars, printer, *method, *itemsField, options
+          );
+        }
+      } else
+      if(method->client_streaming() && method->server_streaming()) {
+        PrintAngularServiceBidiStreamingMethod(vars, printer, *method, options);
+      } else
+      if(method->client_streaming()) {
+        PrintAngularServiceClientStreamingMethod(vars, printer, *method, options);
+      } else
+      if(method->server_streaming()) {
+        PrintAngularServiceServerStreamingMethod(vars, printer, *method, options);
+
+        auto keyField = FindEntityKeyField(*method->output_type(), options);
+
+        if(keyField != nullptr) {
+          PrintAngularServiceEntityStoreMethod(
+            vars, printer, *method, *keyField,
+            FindEntityDeletedField(*method->output_type(), options)
+          );
+        }
+      }
+    }
+
+    printer.Outdent();
+
+    printer.Print("}\n");
+  }
+}
+
+void PrintAngularModuleIndex
+  ( Printer&                                      printer
+  , const std::vector<const ServiceDescriptor*>&  services
+  )
+{
+
+  printer.Print("import { NgModule } from '@angular/core';\n\n");
+
+  for(auto service : services) {
+    map<string, string> vars;
+
+    vars["service_name"] = service->name();
+    vars["service_import"] = "./" + service->name() + ".service";
+
+    printer.Print(vars,
+      "import { $service_name$ } from '$service_import$';\n");
+  }
+
+  printer.Print("\n@NgModule({\n");
+  printer.Indent();
+
+  printer.Print("providers: [\n");
+  printer.Indent();
+
+  for(auto service: services) {
+    map<string, string> vars;
+    vars["service_name"] = service->name();
+
+    printer.Print(vars, "$service_name$,\n");
+  }
+
+  printer.Outdent();
+  printer.Print("]\n");
+
+  printer.Outdent();
+  printer.Print("})\n");
+
+  printer.Print("export class GeneratedGrpcAngularModule {\n");
+  printer.Print("};\n\n");
+
+  printer.Print("export default GeneratedGrpcAngularModule;\n");
+}
+
+void PrintAngularModuleIndexJs
+  ( Printer&                                      printer
+  , const std::vector<const ServiceDescriptor*>&  services
+  )
+{
+  printer.Print("import { NgModule } from '@angular/core';\n\n");
+
+  for(auto service : services) {
+    map<string, string> vars;
+
+    vars["service_name"] = service->name();
+    vars["service_import"] = "./" + service->name() + ".service";
+
+    printer.Print(vars,
+      "import { $service_name$ } from '$service_import$';\n");
+  }
+
+  printer.Print("\nexport class GeneratedGrpcAngularModule {\n");
+  printer.Print("};\n\n");
+
+  printer.Print("GeneratedGrpcAngularModule.decorators = [\n");
+  printer.Indent();
+
+  printer.Print("{ type: NgModule, args: [{\n");
+  printer.Indent();
+
+  printer.Print("providers: [\n");
+  printer.Indent();
+
+  for(auto service: services) {
+    map<string, string> vars;
+    vars["service_name"] = service->name();
+
+    printer.Print(vars, "$service_name$,\n");
+  }
+
+  printer.Outdent();
+  printer.Print("]\n");
+
+  printer.Outdent();
+  printer.Print("}] }\n");
+
+  printer.Outdent();
+  printer.Print("];\n\n");
+
+  printer.Print("export default GeneratedGrpcAngularModule;\n");
+}
+
+void PrintAngularModuleIndexDeclarations
+  ( Printer&  printer
+  )
+{
+  printer.Print("export declare class GeneratedGrpcAngularModule {\n");
+  printer.Print("}\n\n");
+
+  printer.Print("export default GeneratedGrpcAngularModule;\n");
+}
+
+void PrintAngularModuleIndexMetadata
+  ( Printer&                                      printer
+  , const std::vector<const ServiceDescriptor*>&  services
+  )
+{
+  printer.Print(
+    "{\n"
+    "  \"__symbolic\": \"module\",\n"
+    "  \"version\": 4,\n"
+    "  \"metadata\": {\n"
+    "    \"GeneratedGrpcAngularModule\": {\n"
+    "      \"__symbolic\": \"class\",\n"
+    "      \"decorators\": [\n"
+    "        {\n"
+    "          \"__symbolic\": \"call\",\n"
+    "          \"expression\": {\n"
+    "            \"__symbolic\": \"reference\",\n"
+    "            \"module\": \"@angular/core\",\n"
+    "            \"name\": \"NgModule\"\n"
+    "          },\n"
+    "          \"arguments\": [\n"
+    "            {\n"
+    "              \"providers\": [\n"
+  );
+
+  for(size_t i=0; services.size() > i; ++i) {
+    map<string, string> vars;
+    vars["service_name"] = services[i]->name();
+    vars["separator"] = i + 1 < services.size() ? "," : "";
+
+    printer.Print(vars,
+      "                {\n"
+      "                  \"__symbolic\": \"reference\",\n"
+      "                  \"module\": \"./$service_name$.service\",\n"
+      "                  \"name\": \"$service_name$\"\n"
+      "                }$separator$\n"
+    );
+  }
+
+  printer.Print(
+    "              ]\n"
+    "            }\n"
+    "          ]\n"
+    "        }\n"
+    "      ]\n"
+    "    }\n"
+    "  }\n"
+    "}\n"
+  );
+}
+
+void PrintAngularRuntimeEntityStore
+  ( Printer&  printer
+  )
+{
+  printer.Print(
+    "export type EntityChange = 'added'|'updated'|'removed';\n\n"
+    "export interface EntityChangeSet<K> {\n"
+    "  added: K[];\n"
+    "  updated: K[];\n"
+    "  removed: K[];\n"
+    "}\n\n"
+  );
+
+  printer.Print(
+    "// Keeps the latest entity for each key of a stream of upserts. Changes\n"
+    "// are coalesced and emitted once per flush as the changed keys, so\n"
+    "// views can be patched instead of rebuilt on every message. Generated\n"
+    "// stores only remove keys for messages with the entity_deleted field\n"
+    "// set; without that option, removals come from calling remove().\n"
+  );
+  printer.Print("export class EntityStore<K, T> {\n\n");
+  printer.Indent();
+
+  printer.Print(
+    "readonly entities = new Map<K, T>();\n"
+    "version = 0;\n"
+    "close: () => void = () => {};\n\n"
+    "private _changes = new Subject<EntityChangeSet<K>>();\n"
+    "private _pending: Map<K, EntityChange> = null;\n\n"
+    "readonly changes: Observable<EntityChangeSet<K>> = "
+      "this._changes.asObservable();\n\n"
+    "constructor(private _keyOf: (entity: T) => K) {}\n\n"
+  );
+
+  printer.Print(
+    "get(key: K): T|undefined {\n"
+    "  return this.entities.get(key);\n"
+    "}\n\n"
+    "upsert(entity: T): void {\n"
+    "  let key = this._keyOf(entity);\n"
+    "  let change: EntityChange = "
+      "this.entities.has(key) ? 'updated' : 'added';\n\n"
+    "  this.entities.set(key, entity);\n"
+    "  this._mark(key, change);\n"
+    "}\n\n"
+    "remove(key: K): void {\n"
+    "  if(this.entities.delete(key)) {\n"
+    "    this._mark(key, 'removed');\n"
+    "  }\n"
+    "}\n\n"
+    "flush(): void {\n"
+    "  let pending = this._pending;\n"
+    "  this._pending = null;\n\n"
+    "  if(!pending || pending.size == 0) {\n"
+    "    return;\n"
+    "  }\n\n"
+    "  let changeSet: EntityChangeSet<K> = "
+      "{ added: [], updated: [], removed: [] };\n"
+    "  pending.forEach((change, key) => changeSet[change].push(key));\n\n"
+    "  this.version += 1;\n"
+    "  this._changes.next(changeSet);\n"
+    "}\n\n"
+    "error(err: any): void {\n"
+    "  this.flush();\n"
+    "  this._changes.error(err);\n"
+    "}\n\n"
+    "complete(): void {\n"
+    "  this.flush();\n"
+    "  this._changes.complete();\n"
+    "}\n\n"
+  );
+
+  printer.Print(
+    "private _mark(key: K, change: EntityChange): void {\n"
+    "  if(!this._pending) {\n"
+    "    this._pending = new Map<K, EntityChange>();\n"
+    "    Promise.resolve().then(() => this.flush());\n"
+    "  }\n\n"
+    "  let previous = this._pending.get(key);\n\n"
+    "  if(previous === 'added') {\n"
+    "    if(change === 'removed') {\n"
+    "      this._pending.delete(key);\n"
+    "    }\n"
+    "  } else\n"
+    "  if(previous === 'removed' && change === 'added') {\n"
+    "    this._pending.set(key, 'updated');\n"
+    "  } else {\n"
+    "    this._pending.set(key, change);\n"
+    "  }\n"
+    "}\n"
+  );
+
+  printer.Outdent();
+  printer.Print("}\n");
+}
+
+void PrintAngularRuntimeTransport
+  ( Printer&  printer
+  )
+{
+  printer.Print(
+    "export interface GrpcTransport {\n"
+    "  sendMessage(msgBytes: Uint8Array): void;\n"
+    "  finishSend(): void;\n"
+    "  cancel(): void;\n"
+    "  start(metadata: grpc.Metadata): void;\n"
+    "}\n\n"
+    "export type GrpcTransportFactory = "
+      "(options: any) => GrpcTransport;\n\n"
+    "export const GRPC_TRANSPORT = "
+      "new InjectionToken<GrpcTransportFactory>('GRPC_TRANSPORT');\n\n"
+  );
+
+  printer.Print(
+    "export function defaultGrpcTransport(): GrpcTransportFactory {\n"
+    "  let impl = <any>grpc;\n\n"
+    "  if(impl.CrossBrowserHttpTransport) {\n"
+    "    return impl.CrossBrowserHttpTransport({ withCredentials: false });\n"
+    "  }\n\n"
+    "  return options => impl.DefaultTransportFactory.getTransport(options);\n"
+    "}\n\n"
+  );
+
+  printer.Print(
+    "export function frameMessage"
+      "(flags: number, payload: Uint8Array): Uint8Array {\n"
+    "  let frame = new Uint8Array(5 + payload.length);\n"
+    "  new DataView(frame.buffer).setUint32(1, payload.length, false);\n"
+    "  frame[0] = flags;\n"
+    "  frame.set(payload, 5);\n"
+    "  return frame;\n"
+    "}\n\n"
+  );
+
+  printer.Print(
+    "// Splits a byte stream into gRPC frames, calling onFrame with the flags\n"
+    "// and payload of every complete frame. Returns the bytes of a trailing\n"
+    "// partial frame, which must be prepended to the next chunk.\n"
+    "export function readFrames"
+      "(bytes: Uint8Array, onFrame: (flags: number, payload: Uint8Array) => void)"
+      ": Uint8Array {\n"
+    "  let offset = 0;\n\n"
+    "  while(bytes.length - offset >= 5) {\n"
+    "    let view = new DataView(bytes.buffer, bytes.byteOffset + offset, 5);\n"
+    "    let length = view.getUint32(1, false);\n\n"
+    "    if(bytes.length - offset - 5 < length) {\n"
+    "      break;\n"
+    "    }\n\n"
+    "    onFrame(bytes[offset], bytes.subarray(offset + 5, offset + 5 + length));\n"
+    "    offset += 5 + length;\n"
+    "  }\n\n"
+    "  return bytes.slice(offset);\n"
+    "}\n\n"
+    "export function concatBytes(a: Uint8Array, b: Uint8Array): Uint8Array {\n"
+    "  if(a.length == 0) {\n"
+    "    return b;\n"
+    "  }\n\n"
+    "  let bytes = new Uint8Array(a.length + b.length);\n"
+    "  bytes.set(a);\n"
+    "  bytes.set(b, a.length);\n"
+    "  return bytes;\n"
+    "}\n\n"
+    "export function pipeBytes(bytes: Uint8Array, transform: any): "
+      "Promise<Uint8Array> {\n"
+    "  let stream = (<any>new Blob([bytes])).stream().pipeThrough(transform);\n"
+    "  return new Response(stream).arrayBuffer()"
+      ".then(buffer => new Uint8Array(buffer));\n"
+    "}\n"
+  );
+}
+
+void PrintAngularRuntimeGzipTransport
+  ( Printer&  printer
+  )
+{
+  printer.Print(
+    "// Wraps a transport with 'grpc-encoding: gzip' support using the\n"
+    "// browser CompressionStream and DecompressionStream APIs. Requests\n"
+    "// smaller than threshold bytes are sent uncompressed since gzip would\n"
+    "// only add latency. Browsers without the APIs get the inner transport.\n"
+  );
+  printer.Print(
+    "export function gzipTransport"
+      "(threshold: number, inner?: GrpcTransportFactory)"
+      ": GrpcTransportFactory {\n"
+  );
+  printer.Indent();
+
+  printer.Print(
+    "let CompressionStream = (<any>window).CompressionStream;\n"
+    "let DecompressionStream = (<any>window).DecompressionStream;\n\n"
+    "if(!CompressionStream || !DecompressionStream) {\n"
+    "  return inner || defaultGrpcTransport();\n"
+    "}\n\n"
+  );
+
+  printer.Print("return options => {\n");
+  printer.Indent();
+
+  printer.Print(
+    "let outbound = Promise.resolve();\n"
+    "let inbound = Promise.resolve();\n"
+    "let partial = new Uint8Array(0);\n"
+    "let cancelled = false;\n\n"
+  );
+
+  printer.Print(
+    "let onChunk = (chunk: Uint8Array) => {\n"
+    "  partial = readFrames(concatBytes(partial, chunk), (flags, payload) => {\n"
+    "    let frame = (flags & 1)\n"
+    "      ? pipeBytes(payload, new DecompressionStream('gzip'))\n"
+    "          .then(message => frameMessage(flags & ~1, message))\n"
+    "      : Promise.resolve(frameMessage(flags, payload));\n\n"
+    "    inbound = inbound\n"
+    "      .then(() => frame)\n"
+    "      .then(frame => {\n"
+    "        if(!cancelled) options.onChunk(frame);\n"
+    "      });\n"
+    "  });\n"
+    "};\n\n"
+    "let onEnd = (err?: Error) => {\n"
+    "  inbound = inbound.then(\n"
+    "    () => {\n"
+    "      if(!cancelled) options.onEnd(err);\n"
+    "    },\n"
+    "    decompressErr => {\n"
+    "      if(!cancelled) options.onEnd(decompressErr);\n"
+    "    }\n"
+    "  );\n"
+    "};\n\n"
+  );
+
+  printer.Print(
+    "let transport = (inner || defaultGrpcTransport())"
+      "(Object.assign({}, options, { onChunk, onEnd }));\n\n"
+  );
+
+  printer.Print(
+    "return {\n"
+    "  start: metadata => {\n"
+    "    let headers = new grpc.Metadata(metadata);\n"
+    "    headers.set('grpc-encoding', 'gzip');\n"
+    "    headers.set('grpc-accept-encoding', 'gzip');\n"
+    "    transport.start(headers);\n"
+    "  },\n"
+    "  sendMessage: msgBytes => {\n"
+    "    let payload = msgBytes.subarray(5);\n"
+    "    let frame = payload.length < threshold\n"
+    "      ? Promise.resolve(msgBytes)\n"
+    "      : pipeBytes(payload, new CompressionStream('gzip'))"
+      ".then(\n"
+    "          compressed => frameMessage(1, compressed),\n"
+    "          () => msgBytes\n"
+    "        );\n\n"
+    "    outbound = outbound\n"
+    "      .then(() => frame)\n"
+    "      .then(frame => {\n"
+    "        if(!cancelled) transport.sendMessage(frame);\n"
+    "      });\n"
+    "  },\n"
+    "  finishSend: () => {\n"
+    "    outbound = outbound.then(() => {\n"
+    "      if(!cancelled) transport.finishSend();\n"
+    "    });\n"
+    "  },\n"
+    "  cancel: () => {\n"
+    "    cancelled = true;\n"
+    "    transport.cancel();\n"
+    "  }\n"
+    "};\n"
+  );
+
+  printer.Outdent();
+  printer.Print("};\n");
+
+  printer.Outdent();
+  printer.Print("}\n");
+}
+
+void PrintAngularRuntimePagination
+  ( Printer&  printer
+  )
+{
+  printer.Print(
+    "export interface Page<T> {\n"
+    "  items: T[];\n"
+    "  nextPageToken: string;\n"
+    "}\n\n"
+  );
+
+  printer.Print(
+    "export type PageFetcher<T> = (\n"
+    "  pageToken: string,\n"
+    "  callback: (err: any, page: Page<T>) => void\n"
+    ") => {close(): void};\n\n"
+  );
+
+  printer.Print(
+    "// Reads a paged listing one page at a time. Up to `prefetch` pages are\n"
+    "// requested ahead of the page being consumed, each as soon as the\n"
+    "// token of the page before it is known. close() cancels the requests\n"
+    "// still in flight.\n"
+  );
+  printer.Print("export class PageIterator<T> {\n\n");
+  printer.Indent();
+
+  printer.Print(
+    "private _queue: Promise<Page<T>|null>[] = [];\n"
+    "private _last: Promise<Page<T>|null> = null;\n"
+    "private _inFlight: {close(): void}[] = [];\n"
+    "private _closed = false;\n\n"
+    "constructor(\n"
+    "  private _fetchPage: PageFetcher<T>,\n"
+    "  private _firstPageToken: string = '',\n"
+    "  private _prefetch: number = 1\n"
+    ") {}\n\n"
+  );
+
+  printer.Print(
+    "// Resolves with the items of the next page, or null once every page\n"
+    "// has been read.\n"
+    "nextPage(): Promise<T[]|null> {\n"
+    "  if(this._queue.length == 0) {\n"
+    "    this._enqueue();\n"
+    "  }\n\n"
+    "  let page = this._queue.shift();\n"
+    "  this._fill();\n\n"
+    "  if(!page) {\n"
+    "    return Promise.resolve(null);\n"
+    "  }\n\n"
+    "  return page.then(page => {\n"
+    "    if(!page || this._closed) {\n"
+    "      this.close();\n"
+    "      return null;\n"
+    "    }\n\n"
+    "    return page.items;\n"
+    "  });\n"
+    "}\n\n"
+    "close(): void {\n"
+    "  let inFlight = this._inFlight;\n\n"
+    "  this._closed = true;\n"
+    "  this._queue = [];\n"
+    "  this._inFlight = [];\n"
+    "  inFlight.forEach(request => request.close());\n"
+    "}\n\n"
+  );
+
+  printer.Print(
+    "// Queues up to `prefetch` pages after the one being consumed.\n"
+    "private _fill(): void {\n"
+    "  while(!this._closed && this._queue.length < this._prefetch) {\n"
+    "    this._enqueue();\n"
+    "  }\n"
+    "}\n\n"
+    "private _enqueue(): void {\n"
+    "  if(this._closed) {\n"
+    "    return;\n"
+    "  }\n\n"
+    "  let previous = this._last;\n\n"
+    "  this._last = !previous\n"
+    "    ? this._fetch(this._firstPageToken)\n"
+    "    : previous.then(page => {\n"
+    "        if(!page || !page.nextPageToken || this._closed) {\n"
+    "          return null;\n"
+    "        }\n\n"
+    "        return this._fetch(page.nextPageToken);\n"
+    "      });\n\n"
+    "  // Errors are reported by nextPage(), pages dropped by close()\n"
+    "  // shouldn't be reported as unhandled rejections.\n"
+    "  this._last.catch(() => {});\n"
+    "  this._queue.push(this._last);\n"
+    "}\n\n"
+    "// Pages cancelled by close() resolve with null.\n"
+    "private _fetch(pageToken: string): Promise<Page<T>|null> {\n"
+    "  return new Promise<Page<T>|null>((resolve, reject) => {\n"
+    "    let request = {\n"
+    "      close: () => {\n"
+    "        call.close();\n"
+    "        resolve(null);\n"
+    "      }\n"
+    "    };\n\n"
+    "    let settled = false;\n"
+    "    let call = this._fetchPage(pageToken, (err, page) => {\n"
+    "      let index = this._inFlight.indexOf(request);\n\n"
+    "      settled = true;\n\n"
+    "      if(index >= 0) {\n"
+    "        this._inFlight.splice(index, 1);\n"
+    "      }\n\n"
+    "      if(err) {\n"
+    "        reject(err);\n"
+    "      } else {\n"
+    "        resolve(page);\n"
+    "      }\n"
+    "    });\n\n"
+    "    if(!settled) {\n"
+    "      this._inFlight.push(request);\n"
+    "    }\n"
+    "  });\n"
+    "}\n"
+  );
+
+  printer.Outdent();
+  printer.Print("}\n\n");
+
+  printer.Print(
+    "export function pagedObservable<T>"
+      "(createPages: () => PageIterator<T>): Observable<T> {\n"
+    "  return new Observable<T>(subscriber => {\n"
+    "    let pages = createPages();\n"
+    "    let pump = () => pages.nextPage().then(items => {\n"
+    "      if(items === null) {\n"
+    "        subscriber.complete();\n"
+    "        return;\n"
+    "      }\n\n"
+    "      items.forEach(item => subscriber.next(item));\n"
+    "      pump();\n"
+    "    }, err => subscriber.error(err));\n\n"
+    "    pump();\n\n"
+    "    return () => pages.close();\n"
+    "  });\n"
+    "}\n"
+  );
+}
+
+void PrintAngularRuntimeHedging
+  ( Printer&  printer
+  )
+{
+  printer.Print(
+    "export type HedgeCallback = (err: any, ...results: any[]) => void;\n\n"
+    "export interface HedgeAttempt {\n"
+    "  close(): void;\n"
+    "}\n\n"
+  );
+
+  printer.Print(
+    "function hedgeNow(): number {\n"
+    "  return typeof performance !== 'undefined'"
+      " ? performance.now() : Date.now();\n"
+    "}\n\n"
+  );
+
+  printer.Print(
+    "// Sends a second copy of a side-effect free call when the first one\n"
+    "// hasn't answered after the hedge delay, and keeps whichever answers\n"
+    "// first. The delay is the p95 latency of recent calls unless a fixed\n"
+    "// delay is given, and at most maxRate percent of calls are hedged.\n"
+  );
+  printer.Print("export class HedgePolicy {\n\n");
+  printer.Indent();
+
+  printer.Print(
+    "static readonly initialDelay = 100;\n"
+    "static readonly minSamples = 20;\n"
+    "static readonly maxSamples = 100;\n\n"
+    "private _samples: number[] = [];\n"
+    "private _nextSample = 0;\n"
+    "private _calls = 0;\n"
+    "private _hedges = 0;\n\n"
+    "constructor(\n"
+    "  private _fixedDelay: number = 0,\n"
+    "  private _maxRate: number = 10\n"
+    ") {}\n\n"
+  );
+
+  printer.Print(
+    "delay(): number {\n"
+    "  if(this._fixedDelay > 0) {\n"
+    "    return this._fixedDelay;\n"
+    "  }\n\n"
+    "  if(this._samples.length < HedgePolicy.minSamples) {\n"
+    "    return HedgePolicy.initialDelay;\n"
+    "  }\n\n"
+    "  let sorted = this._samples.slice().sort((a, b) => a - b);\n"
+    "  return sorted[Math.floor((sorted.length - 1) * 0.95)];\n"
+    "}\n\n"
+  );
+
+  printer.Print(
+    "// Runs start() once, and a second time if the hedge delay passes\n"
+    "// first. The first attempt to succeed is reported and the others are\n"
+    "// closed. An error is only reported once no attempt is left running.\n"
+    "invoke(start: (done: HedgeCallback) => HedgeAttempt, "
+      "callback: HedgeCallback): HedgeAttempt {\n"
+    "  let attempts: HedgeAttempt[] = [];\n"
+    "  let pending = 0;\n"
+    "  let winner = -1;\n"
+    "  let timer = null;\n"
+    "  let startedAt = hedgeNow();\n\n"
+    "  let launch = () => {\n"
+    "    let index = attempts.length;\n\n"
+    "    attempts.push(null);\n"
+    "    pending++;\n\n"
+    "    attempts[index] = start((err, ...results) => {\n"
+    "      if(winner >= 0) {\n"
+    "        return;\n"
+    "      }\n\n"
+    "      pending--;\n\n"
+    "      if(err && pending > 0) {\n"
+    "        return;\n"
+    "      }\n\n"
+    "      winner = index;\n"
+    "      clearTimeout(timer);\n\n"
+    "      // Latency of the call as the caller saw it, so hedged calls that\n"
+    "      // won late don't pull the delay down.\n"
+    "      if(!err) {\n"
+    "        this._record(hedgeNow() - startedAt);\n"
+    "      }\n\n"
+    "      attempts.forEach((attempt, i) => {\n"
+    "        if(attempt && i != index) {\n"
+    "          attempt.close();\n"
+    "        }\n"
+    "      });\n\n"
+    "      callback(err, ...results);\n"
+    "    });\n\n"
+    "    if(winner >= 0 && winner != index) {\n"
+    "      attempts[index].close();\n"
+    "    }\n"
+    "  };\n\n"
+    "  this._countCall();\n"
+    "  launch();\n\n"
+    "  if(winner < 0) {\n"
+    "    timer = setTimeout(() => {\n"
+    "      if(winner < 0 && this._hedges * 100 < this._maxRate * this._calls) {\n"
+    "        this._hedges++;\n"
+    "        launch();\n"
+    "      }\n"
+    "    }, this.delay());\n"
+    "  }\n\n"
+    "  return {\n"
+    "    close: () => {\n"
+    "      if(winner < 0) {\n"
+    "        winner = attempts.length;\n"
+    "        clearTimeout(timer);\n"
+    "        attempts.forEach(attempt => attempt && attempt.close());\n"
+    "      }\n"
+    "    }\n"
+    "  };\n"
+    "}\n\n"
+  );
+
+  printer.Print(
+    "private _record(latency: number): void {\n"
+    "  this._samples[this._nextSample] = latency;\n"
+    "  this._nextSample = (this._nextSample + 1) % HedgePolicy.maxSamples;\n"
+    "}\n\n"
+    "// The hedge rate is measured over roughly the last thousand calls.\n"
+    "private _countCall(): void {\n"
+    "  if(++this._calls >= 1000) {\n"
+    "    this._calls /= 2;\n"
+    "    this._hedges /= 2;\n"
+    "  }\n"
+    "}\n"
+  );
+
+  printer.Outdent();
+  printer.Print("}\n");
+}
+
+void PrintAngularRuntimeLoopback
+  ( Printer&  printer
+  )
+{
+  printer.Print(
+    "export class LoopbackError extends Error {\n"
+    "  constructor(public code: grpc.Code, message: string) {\n"
+    "    super(message);\n"
+    "  }\n"
+    "}\n\n"
+  );
+
+  printer.Print(
+    "// Serves calls in-process from registered handlers. Messages still go\n"
+    "// through protobuf serialization and grpc-web framing so the client\n"
+    "// side of a call costs the same as it would against a real backend.\n"
+  );
+  printer.Print("export class LoopbackServer {\n\n");
+  printer.Indent();
+
+  printer.Print(
+    "calls = 0;\n\n"
+    "private _handlers = new Map<string, Function>();\n\n"
+    "handle(methodDefinition: any, handler: Function): void {\n"
+    "  this._handlers.set(this._methodPath(methodDefinition), handler);\n"
+    "}\n\n"
+  );
+
+  printer.Print("transport(): GrpcTransportFactory {\n");
+  printer.Indent();
+
+  printer.Print("return options => {\n");
+  printer.Indent();
+
+  printer.Print(
+    "let method = options.methodDefinition;\n"
+    "let path = this._methodPath(method);\n"
+    "let metadata: grpc.Metadata = null;\n"
+    "let requests: Promise<Uint8Array>[] = [];\n"
+    "let partial = new Uint8Array(0);\n"
+    "let headersSent = false;\n"
+    "let done = false;\n\n"
+  );
+
+  printer.Print(
+    "let sendHeaders = () => {\n"
+    "  headersSent = true;\n"
+    "  options.onHeaders(new grpc.Metadata({\n"
+    "    'content-type': 'application/grpc-web+proto'\n"
+    "  }), 200);\n"
+    "};\n\n"
+    "let finish = (code: grpc.Code, message: string) => {\n"
+    "  if(done) {\n"
+    "    return;\n"
+    "  }\n\n"
+    "  done = true;\n\n"
+    "  if(headersSent) {\n"
+    "    options.onChunk(frameMessage(0x80, encodeTrailers(code, message)));\n"
+    "  } else {\n"
+    "    // Trailers-only response\n"
+    "    options.onHeaders(new grpc.Metadata({\n"
+    "      'content-type': 'application/grpc-web+proto',\n"
+    "      'grpc-status': String(code),\n"
+    "      'grpc-message': message\n"
+    "    }), 200);\n"
+    "  }\n\n"
+    "  options.onEnd();\n"
+    "};\n\n"
+    "let send = (response: any) => {\n"
+    "  if(!done) {\n"
+    "    if(!headersSent) {\n"
+    "      sendHeaders();\n"
+    "    }\n\n"
+    "    options.onChunk(frameMessage(0, response.serializeBinary()));\n"
+    "  }\n"
+    "};\n\n"
+  );
 
-  }
+  printer.Print(
+    "let dispatch = (payloads: Uint8Array[]) => {\n"
+    "  let handler = this._handlers.get(path);\n\n"
+    "  if(done) {\n"
+    "    return Promise.resolve();\n"
+    "  }\n\n"
+    "  if(!handler) {\n"
+    "    throw new LoopbackError(\n"
+    "      grpc.Code.Unimplemented, path + ' has no loopback handler'\n"
+    "    );\n"
+    "  }\n\n"
+    "  let request = method.requestType.deserializeBinary(\n"
+    "    payloads[0] || new Uint8Array(0)\n"
+    "  );\n\n"
+    "  this.calls += 1;\n\n"
+    "  if(method.responseStream) {\n"
+    "    return Promise.resolve(handler(request, metadata, send));\n"
+    "  }\n\n"
+    "  return Promise.resolve(handler(request, metadata)).then(send);\n"
+    "};\n\n"
+  );
 
-  void PrintAngularServiceClientStreamingMethod
-    ( map<string, string>           vars
-    , Printer&                      printer
-    , const MethodDescriptor&       method
-    , const GrpcWebImplementation&  grpcWebImpl
-    )
-  {
+  printer.Print(
+    "return {\n"
+    "  start: requestMetadata => {\n"
+    "    metadata = requestMetadata;\n"
+    "  },\n"
+    "  sendMessage: msgBytes => {\n"
+    "    partial = readFrames(concatBytes(partial, msgBytes), (flags, payload) => {\n"
+    "      requests.push((flags & 1)\n"
+    "        ? pipeBytes(payload, new (<any>window).DecompressionStream('gzip'))\n"
+    "        : Promise.resolve(payload));\n"
+    "    });\n"
+    "  },\n"
+    "  finishSend: () => {\n"
+    "    Promise.all(requests)\n"
+    "      .then(dispatch)\n"
+    "      .then(\n"
+    "        () => finish(grpc.Code.OK, ''),\n"
+    "        err => finish(err.code || grpc.Code.Unknown, String(err.message || err))\n"
+    "      );\n"
+    "  },\n"
+    "  cancel: () => {\n"
+    "    done = true;\n"
+    "  }\n"
+    "};\n"
+  );
 
-  }
-  
-  void PrintAngularServiceServerStreamingMethod
-    ( map<string, string>           vars
-    , Printer&                      printer
-    , const MethodDescriptor&       method
-    , const GrpcWebImplementation&  grpcWebImpl
-    )
-  {
-    auto inputType = method.input_type();
-    auto outputType = method.output_type();
+  printer.Outdent();
+  printer.Print("};\n");
 
-    vars["method_name"] = firstCharToLower(method.name());
-    vars["Method_name"] = method.name();
-    vars["input_type"] = inputType->name();
-    vars["output_type"] = outputType->name();
-    vars["msg_cb"] =
-      "(message?: " + outputType->name() + ") => void";
-    vars["error_cb"] = "(err) => void";
-    vars["end_cb"] = "("
-      "code: grpc.Code, "
-      "msg: string|undefined, "
-      "metadata: grpc.Metadata"
-    ") => void";
+  printer.Outdent();
+  printer.Print("}\n\n");
 
-    // A few signatures
-    printer.Print(vars,
-      "$method_name$("
-        "request: $input_type$"
-      "): {close():void}&Observable<$output_type$>;\n"
-    );
+  printer.Print(
+    "private _methodPath(methodDefinition: any): string {\n"
+    "  return methodDefinition.service.serviceName"
+      " + '/' + methodDefinition.methodName;\n"
+    "}\n"
+  );
 
-    printer.Print(vars,
-      "$method_name$("
-        "request: $input_type$, "
-        "metadata: grpc.Metadata"
-      "): {close():void}&Observable<$output_type$>;\n"
-    );
-    
-    printer.Print(vars,
-      "$method_name$("
-        "request: $input_type$, "
-        "onMessage: $msg_cb$,"
-        "onError?: $error_cb$,"
-        "onEnd?: $end_cb$"
-      "): void;\n"
-    );
+  printer.Outdent();
+  printer.Print("}\n\n");
+
+  printer.Print(
+    "function encodeTrailers(code: grpc.Code, message: string): Uint8Array {\n"
+    "  let trailers = 'grpc-status:' + code + '\\r\\n'\n"
+    "    + 'grpc-message:' + message.replace(/[\\r\\n]/g, ' ') + '\\r\\n';\n"
+    "  let bytes = new Uint8Array(trailers.length);\n\n"
+    "  for(let i = 0; i < trailers.length; ++i) {\n"
+    "    bytes[i] = trailers.charCodeAt(i) & 0xff;\n"
+    "  }\n\n"
+    "  return bytes;\n"
+    "}\n"
+  );
+}
 
-    printer.Print(vars,
-      "$method_name$("
-        "request: $input_type$, "
-        "metadata: grpc.Metadata, "
-        "onMessage: $msg_cb$,"
-        "onError?: $error_cb$,"
-        "onEnd?: $end_cb$"
-      "): void;\n\n"
-    );
+void PrintAngularRuntimeScheduler
+  ( Printer&  printer
+  )
+{
+  printer.Print(
+    "export enum RpcPriority {\n"
+    "  Low = 0,\n"
+    "  Normal = 1,\n"
+    "  High = 2\n"
+    "}\n\n"
+    "export interface RpcSchedulerConfig {\n"
+    "  // Calls in flight per host, streams included.\n"
+    "  maxInFlight?: number;\n"
+    "  // Streams in flight per host. Streams take their slots out of\n"
+    "  // maxInFlight, so keep this below it to leave room for unary calls.\n"
+    "  maxStreams?: number;\n"
+    "  // Milliseconds after which a queued call goes ahead of any priority.\n"
+    "  maxWait?: number;\n"
+    "}\n\n"
+    "export const RPC_SCHEDULER = "
+      "new InjectionToken<RpcScheduler>('RPC_SCHEDULER');\n\n"
+  );
 
-    printer.Print(vars,
-      "$method_name$("
-        "request: $input_type$, "
-        "arg1?: grpc.Metadata|($msg_cb$), "
-        "arg2?: ($msg_cb$)|($error_cb$), "
-        "arg3?: ($error_cb$)|($end_cb$), "
-        "arg4?: $end_cb$"
-      "): {close():void}&Observable<$output_type$>|void {\n"
-    );
+  printer.Print(
+    "interface RpcSchedulerEntry {\n"
+    "  priority: RpcPriority;\n"
+    "  stream: boolean;\n"
+    "  queuedAt: number;\n"
+    "  start: () => void;\n"
+    "}\n\n"
+    "class RpcSchedulerHost {\n"
+    "  inFlight = 0;\n"
+    "  streams = 0;\n"
+    "  queues: RpcSchedulerEntry[][] = [[], [], []];\n"
+    "}\n\n"
+  );
 
-    printer.Indent();
+  printer.Print(
+    "// Limits the calls in flight to each host so low priority calls can't\n"
+    "// take up the browser's connections while a more important call waits.\n"
+    "// Queued calls start in priority order, first in first out within a\n"
+    "// priority. Streams count against the same limit but hold at most\n"
+    "// maxStreams of its slots, so long-lived streams can't block unary calls.\n"
+    "// A stream queued while maxStreams streams are open waits until one of\n"
+    "// them ends, however long that takes; maxWait only reorders calls that\n"
+    "// are allowed to start.\n"
+  );
+  printer.Print("export class RpcScheduler {\n\n");
+  printer.Indent();
 
-    PrintAngularServiceServerStreamingMethodBody(
-      vars, printer, method, grpcWebImpl
-    );
+  printer.Print(
+    "private _hosts = new Map<string, RpcSchedulerHost>();\n"
+    "private _priority: RpcPriority = null;\n"
+    "private _maxInFlight: number;\n"
+    "private _maxStreams: number;\n"
+    "private _maxWait: number;\n\n"
+    "constructor(config: RpcSchedulerConfig = {}) {\n"
+    "  this._maxInFlight = config.maxInFlight !== undefined\n"
+    "    ? config.maxInFlight : 6;\n"
+    "  this._maxStreams = config.maxStreams !== undefined\n"
+    "    ? config.maxStreams : 4;\n"
+    "  this._maxWait = config.maxWait !== undefined\n"
+    "    ? config.maxWait : 1000;\n"
+    "}\n\n"
+  );
 
-    printer.Outdent();
+  printer.Print(
+    "// The priority set by the enclosing withPriority(), or null.\n"
+    "currentPriority(): RpcPriority {\n"
+    "  return this._priority;\n"
+    "}\n\n"
+    "// Calls started by fn use the given priority instead of the one\n"
+    "// generated for their method. Generated follow-up calls, hedges and\n"
+    "// further pages, keep the priority of the call that started them. Other\n"
+    "// asynchronous work started by fn doesn't.\n"
+    "withPriority<T>(priority: RpcPriority, fn: () => T): T {\n"
+    "  let previous = this._priority;\n"
+    "  this._priority = priority;\n\n"
+    "  try {\n"
+    "    return fn();\n"
+    "  } finally {\n"
+    "    this._priority = previous;\n"
+    "  }\n"
+    "}\n\n"
+  );
 
-    printer.Print("}\n\n");
-  }
+  printer.Print(
+    "// Wraps a transport so its calls wait for a free slot of their host.\n"
+    "// The priority is fixed when transport() is called. Anything sent before\n"
+    "// the call starts is replayed once it does.\n"
+    "transport(priority: RpcPriority, inner?: GrpcTransportFactory)"
+      ": GrpcTransportFactory {\n"
+    "  let callPriority = this._priority !== null ? this._priority : priority;\n\n"
+    "  return options => {\n"
+    "    let method = options.methodDefinition;\n"
+    "    let host = this._host(options.url);\n"
+    "    let transport: GrpcTransport = null;\n"
+    "    let pending: ((transport: GrpcTransport) => void)[] = [];\n"
+    "    let finished = false;\n\n"
+    "    let entry: RpcSchedulerEntry = {\n"
+    "      priority: callPriority,\n"
+    "      stream: !!(method.requestStream || method.responseStream),\n"
+    "      queuedAt: Date.now(),\n"
+    "      start: () => {\n"
+    "        transport = (inner || defaultGrpcTransport())"
+      "(Object.assign({}, options, {\n"
+    "          onEnd: (err?: Error) => {\n"
+    "            finish();\n"
+    "            options.onEnd(err);\n"
+    "          }\n"
+    "        }));\n\n"
+    "        pending.forEach(op => op(transport));\n"
+    "        pending = [];\n"
+    "      }\n"
+    "    };\n\n"
+    "    let finish = () => {\n"
+    "      if(!finished) {\n"
+    "        finished = true;\n"
+    "        host.inFlight--;\n\n"
+    "        if(entry.stream) {\n"
+    "          host.streams--;\n"
+    "        }\n\n"
+    "        this._dispatch(host);\n"
+    "      }\n"
+    "    };\n\n"
+    "    let run = (op: (transport: GrpcTransport) => void) => {\n"
+    "      if(transport) {\n"
+    "        op(transport);\n"
+    "      } else {\n"
+    "        pending.push(op);\n"
+    "      }\n"
+    "    };\n\n"
+    "    host.queues[entry.priority].push(entry);\n"
+    "    this._dispatch(host);\n\n"
+    "    return {\n"
+    "      start: metadata => run(transport => transport.start(metadata)),\n"
+    "      sendMessage: msgBytes => "
+      "run(transport => transport.sendMessage(msgBytes)),\n"
+    "      finishSend: () => run(transport => transport.finishSend()),\n"
+    "      cancel: () => {\n"
+    "        if(transport) {\n"
+    "          transport.cancel();\n"
+    "          finish();\n"
+    "          return;\n"
+    "        }\n\n"
+    "        let queue = host.queues[entry.priority];\n"
+    "        let index = queue.indexOf(entry);\n\n"
+    "        if(index >= 0) {\n"
+    "          queue.splice(index, 1);\n"
+    "        }\n"
+    "      }\n"
+    "    };\n"
+    "  };\n"
+    "}\n\n"
+  );
 
-  void PrintAngularService
-    ( map<string, string>           vars
-    , Printer&                      printer
-    , const ServiceDescriptor&      service
-    , const GrpcWebImplementation&  grpcWebImpl
-    )
-  {
-    string filename = service.file()->name();
-    filename = filename.substr(0, filename.size() - 6);
+  printer.Print(
+    "private _host(url: string): RpcSchedulerHost {\n"
+    "  let key = url.split('/').slice(0, 3).join('/');\n"
+    "  let host = this._hosts.get(key);\n\n"
+    "  if(!host) {\n"
+    "    host = new RpcSchedulerHost();\n"
+    "    this._hosts.set(key, host);\n"
+    "  }\n\n"
+    "  return host;\n"
+    "}\n\n"
+    "private _dispatch(host: RpcSchedulerHost): void {\n"
+    "  while(host.inFlight < this._maxInFlight) {\n"
+    "    let entry = this._next(host);\n\n"
+    "    if(!entry) {\n"
+    "      return;\n"
+    "    }\n\n"
+    "    host.inFlight++;\n\n"
+    "    if(entry.stream) {\n"
+    "      host.streams++;\n"
+    "    }\n\n"
+    "    entry.start();\n"
+    "  }\n"
+    "}\n\n"
+    "// Takes the highest priority call that may start, unless one has been\n"
+    "// queued for longer than maxWait, in which case the longest waiting call\n"
+    "// goes first so low priorities are never starved.\n"
+    "private _next(host: RpcSchedulerHost): RpcSchedulerEntry {\n"
+    "  let canStart = (entry: RpcSchedulerEntry) =>\n"
+    "    !entry.stream || host.streams < this._maxStreams;\n"
+    "  let candidates = host.queues.map(queue => queue.filter(canStart)[0]);\n"
+    "  let next: RpcSchedulerEntry = null;\n\n"
+    "  for(let entry of candidates) {\n"
+    "    if(entry && (!next || entry.queuedAt < next.queuedAt)) {\n"
+    "      next = entry;\n"
+    "    }\n"
+    "  }\n\n"
+    "  if(!next) {\n"
+    "    return null;\n"
+    "  }\n\n"
+    "  if(Date.now() - next.queuedAt <= this._maxWait) {\n"
+    "    for(let priority = candidates.length - 1; priority >= 0; --priority) {\n"
+    "      if(candidates[priority]) {\n"
+    "        next = candidates[priority];\n"
+    "        break;\n"
+    "      }\n"
+    "    }\n"
+    "  }\n\n"
+    "  let queue = host.queues[next.priority];\n"
+    "  queue.splice(queue.indexOf(next), 1);\n"
+    "  return next;\n"
+    "}\n"
+  );
 
-    vars["service_name"] = service.name();
-    vars["service_import"] = filename + "_pb_service";
-    vars["file_import_prefix"] = getImportPrefix(filename);
-    printer.Print("import { Injectable, NgZone } from '@angular/core';\n");
-    printer.Print("import { Observable } from 'rxjs';\n");
-    printer.Print("import { Subject } from 'rxjs';\n");
-    printer.Print("import { grpc } from 'grpc-web-client';\n\n");
-    
-    auto importTypes = GetAllServiceMessages(service);
+  printer.Outdent();
+  printer.Print("}\n\n");
+
+  printer.Print(
+    "let sharedRpcScheduler: RpcScheduler = null;\n\n"
+    "// Services share one scheduler unless RPC_SCHEDULER is provided, since\n"
+    "// the connection limit is per host rather than per service.\n"
+    "export function defaultRpcScheduler(): RpcScheduler {\n"
+    "  if(!sharedRpcScheduler) {\n"
+    "    sharedRpcScheduler = new RpcScheduler();\n"
+    "  }\n\n"
+    "  return sharedRpcScheduler;\n"
+    "}\n"
+  );
+}
 
-    for(auto pair : importTypes) {
-      map<string, string> importVars{vars};
-      auto importName = pair.first;
-      auto importType = pair.second;
-      string filename = importType->file()->name();
-      filename = filename.substr(0, filename.size() - 6);
+void PrintAngularRuntime
+  ( Printer&                 printer
+  , const GeneratorOptions&  options
+  )
+{
+  bool needsTransport = NeedsInjectedTransport(options);
+  // Sections are separated by a blank line, as are the imports if any.
+  bool needsSeparator = needsTransport
+    || !options.entityKey.empty()
+    || options.paginate;
+  vector<void(*)(Printer&)> sections;
+
+  if(needsTransport) {
+    printer.Print("import { InjectionToken } from '@angular/core';\n");
+  }
 
-      importVars["import_name"] = importName;
-      importVars["type_import"] = filename + "_pb";
+  if(!options.entityKey.empty() || options.paginate) {
+    printer.Print("import { Observable } from 'rxjs';\n");
+  }
 
-      printer.Print(importVars,
-        "import { $import_name$ } from '$file_import_prefix$$web_import_prefix$/$type_import$';\n");
-    }
+  if(!options.entityKey.empty()) {
+    printer.Print("import { Subject } from 'rxjs';\n");
+  }
 
-    printer.Print("\n");
+  if(needsTransport) {
+    printer.Print("import { grpc } from 'grpc-web-client';\n");
+    sections.push_back(&PrintAngularRuntimeTransport);
+  }
 
-    printer.Print(vars,
-      "import { $service_name$ as __service } from '$file_import_prefix$$grpc_web_import_prefix$/$service_import$';\n\n");
+  if(!options.entityKey.empty()) {
+    sections.push_back(&PrintAngularRuntimeEntityStore);
+  }
 
-    printer.Print("@Injectable()\n");
-    printer.Print(("export class " + service.name() + " {\n\n").c_str());
+  if(!options.compressMethods.empty()) {
+    sections.push_back(&PrintAngularRuntimeGzipTransport);
+  }
 
-    printer.Indent();
+  if(options.paginate) {
+    sections.push_back(&PrintAngularRuntimePagination);
+  }
 
-    printer.Print(
-      "constructor("
-        "private _ngZone: NgZone"
-      ") {}\n\n"
-    );
+  if(options.loopback) {
+    sections.push_back(&PrintAngularRuntimeLoopback);
+  }
 
-    auto methodCount = service.method_count();
+  if(options.hedge) {
+    sections.push_back(&PrintAngularRuntimeHedging);
+  }
 
-    for(auto i=0; methodCount > i; ++i) {
-      auto method = service.method(i);
+  if(options.schedule) {
+    sections.push_back(&PrintAngularRuntimeScheduler);
+  }
 
-      if(!method->client_streaming() && !method->server_streaming()) {
-        PrintAngularServiceUnaryMethod(vars, printer, *method, grpcWebImpl);
-      } else
-      if(method->client_streaming() && method->server_streaming()) {
-        PrintAngularServiceBidiStreamingMethod(vars, printer, *method, grpcWebImpl);
-      } else
-      if(method->client_streaming()) {
-        PrintAngularServiceClientStreamingMethod(vars, printer, *method, grpcWebImpl);
-      } else
-      if(method->server_streaming()) {
-        PrintAngularServiceServerStreamingMethod(vars, printer, *method, grpcWebImpl);
-      }
+  for(auto printSection : sections) {
+    if(needsSeparator) {
+      printer.Print("\n");
     }
 
-    printer.Outdent();
-
-    printer.Print("}\n");
+    needsSeparator = true;
+    printSection(printer);
   }
 }
 
-void PrintAngularModuleIndex
+void PrintAngularLoopbackBenchmark
   ( Printer&                                      printer
   , const std::vector<const ServiceDescriptor*>&  services
+  , const GeneratorOptions&                       options
   )
 {
+  printer.Print(
+    "// Measures the client side overhead of the generated services against\n"
+    "// the in-process LoopbackServer: calls per second of unary methods, the\n"
+    "// cost per message of server streams and NgZone entries per call.\n"
+    "//\n"
+    "//   runLoopbackBenchmarks(1000).then(results => console.table(results));\n\n"
+  );
 
-  printer.Print("import { NgModule } from '@angular/core';\n\n");
+  printer.Print("import { Observable } from 'rxjs';\n\n");
 
   for(auto service : services) {
-    map<string, string> vars;
+    map<string, string> vars = GetImportPrefixVars(options);
+    string filename = service->file()->name();
+    filename = filename.substr(0, filename.size() - 6);
 
     vars["service_name"] = service->name();
-    vars["service_import"] = "./" + service->name() + ".service";
+    vars["service_import"] = filename + "_pb_service";
+    vars["file_import_prefix"] = getImportPrefix(filename);
 
     printer.Print(vars,
-      "import { $service_name$ } from '$service_import$';\n");
+      "import { $service_name$ } from './$service_name$.service';\n"
+      "import { $service_name$ as __$service_name$ } from '$file_import_prefix$$grpc_web_import_prefix$/$service_import$';\n"
+    );
   }
 
-  printer.Print("\n@NgModule({\n");
-  printer.Indent();
+  printer.Print("\nimport { LoopbackServer } from './runtime';\n\n");
+
+  printer.Print(
+    "export interface LoopbackBenchmarkResult {\n"
+    "  method: string;\n"
+    "  callsPerSecond?: number;\n"
+    "  microsPerMessage?: number;\n"
+    "  zoneEntriesPerCall: number;\n"
+    "}\n\n"
+    "class CountingZone {\n"
+    "  entries = 0;\n\n"
+    "  run<T>(fn: () => T): T {\n"
+    "    this.entries += 1;\n"
+    "    return fn();\n"
+    "  }\n"
+    "}\n\n"
+    "function now(): number {\n"
+    "  return typeof performance !== 'undefined' ? performance.now() : Date.now();\n"
+    "}\n\n"
+  );
 
-  printer.Print("providers: [\n");
+  printer.Print(
+    "function benchmarkUnary(\n"
+    "  method: string,\n"
+    "  zone: CountingZone,\n"
+    "  iterations: number,\n"
+    "  call: () => Promise<any>\n"
+    "): Promise<LoopbackBenchmarkResult> {\n"
+    "  let entries = zone.entries;\n"
+    "  let started = now();\n"
+    "  let next = (remaining: number): Promise<any> => remaining > 0\n"
+    "    ? call().then(() => next(remaining - 1))\n"
+    "    : Promise.resolve();\n\n"
+    "  return next(iterations).then(() => ({\n"
+    "    method: method,\n"
+    "    callsPerSecond: iterations * 1000 / (now() - started),\n"
+    "    zoneEntriesPerCall: (zone.entries - entries) / iterations\n"
+    "  }));\n"
+    "}\n\n"
+  );
+
+  printer.Print(
+    "function benchmarkServerStream(\n"
+    "  method: string,\n"
+    "  zone: CountingZone,\n"
+    "  messages: number,\n"
+    "  call: () => Observable<any>\n"
+    "): Promise<LoopbackBenchmarkResult> {\n"
+    "  let entries = zone.entries;\n"
+    "  let started = now();\n\n"
+    "  return new Promise<LoopbackBenchmarkResult>((resolve, reject) => {\n"
+    "    call().subscribe(() => {}, reject, () => resolve({\n"
+    "      method: method,\n"
+    "      microsPerMessage: (now() - started) * 1000 / messages,\n"
+    "      zoneEntriesPerCall: zone.entries - entries\n"
+    "    }));\n"
+    "  });\n"
+    "}\n\n"
+  );
+
+  printer.Print(
+    "export function runLoopbackBenchmarks"
+      "(iterations: number = 1000): Promise<LoopbackBenchmarkResult[]> {\n"
+  );
   printer.Indent();
 
-  for(auto service: services) {
+  printer.Print(
+    "let global = Function('return this')();\n\n"
+    "if(!global.window) {\n"
+    "  global.window = { DEFAULT_ANGULAR_GRPC_HOST: 'http://loopback' };\n"
+    "}\n\n"
+    "let zone = new CountingZone();\n"
+    "let server = new LoopbackServer();\n"
+    "let results: LoopbackBenchmarkResult[] = [];\n"
+    "let run = Promise.resolve();\n\n"
+  );
+
+  for(auto service : services) {
     map<string, string> vars;
     vars["service_name"] = service->name();
+    vars["service_var"] = firstCharToLower(service->name());
 
-    printer.Print(vars, "$service_name$,\n");
-  }
+    printer.Print(vars,
+      "let $service_var$ = new $service_name$(<any>zone, server.transport());\n\n");
 
-  printer.Outdent();
-  printer.Print("]\n");
+    auto methodCount = service->method_count();
 
-  printer.Outdent();
-  printer.Print("})\n");
+    for(auto i=0; methodCount > i; ++i) {
+      auto method = service->method(i);
 
-  printer.Print("export class GeneratedGrpcAngularModule {\n");
-  printer.Print("};\n\n");
+      if(method->client_streaming()) {
+        continue;
+      }
 
-  printer.Print("export default GeneratedGrpcAngularModule;\n");
+      vars["method_name"] = firstCharToLower(method->name());
+      vars["Method_name"] = method->name();
+
+      if(method->server_streaming()) {
+        printer.Print(vars,
+          "server.handle(__$service_name$.$Method_name$, "
+            "(request: any, metadata: any, send: (response: any) => void) => {\n"
+          "  for(let i = 0; i < iterations; ++i) {\n"
+          "    send(new __$service_name$.$Method_name$.responseType());\n"
+          "  }\n"
+          "});\n"
+          "run = run.then(() => benchmarkServerStream(\n"
+          "  '$service_name$.$Method_name$', zone, iterations,\n"
+          "  () => $service_var$.$method_name$("
+            "new __$service_name$.$Method_name$.requestType())\n"
+          ")).then(result => {\n"
+          "  results.push(result);\n"
+          "});\n\n"
+        );
+      } else {
+        printer.Print(vars,
+          "server.handle(__$service_name$.$Method_name$, () =>\n"
+          "  new __$service_name$.$Method_name$.responseType());\n"
+          "run = run.then(() => benchmarkUnary(\n"
+          "  '$service_name$.$Method_name$', zone, iterations,\n"
+          "  () => $service_var$.$method_name$("
+            "new __$service_name$.$Method_name$.requestType())\n"
+          ")).then(result => {\n"
+          "  results.push(result);\n"
+          "});\n\n"
+        );
+      }
+    }
+  }
+
+  printer.Print("return run.then(() => results);\n");
+
+  printer.Outdent();
+  printer.Print("}\n");
 }
 
 AngularGrpcCodeGenerator::AngularGrpcCodeGenerator() {}
@@ -598,9 +3174,6 @@ bool AngularGrpcCodeGenerator::GenerateFileGroup
   ) const
 {
   std::vector<const ServiceDescriptor*> services;
-  std::unique_ptr<ZeroCopyOutputStream> moduleFileStream(
-    context->Open(rootDir + "/index.ts")
-  );
 
   for(auto file : files) {
     auto serviceCount = file->service_count();
@@ -614,9 +3187,77 @@ bool AngularGrpcCodeGenerator::GenerateFileGroup
     }
   }
 
-  Printer printer(moduleFileStream.get(), '$');
+  GeneratorOptions options;
+  string optionsError;
+
+  // Without services Generate never validated the options. Keep emitting
+  // the (empty) module in that case.
+  if(!ParseGeneratorOptions(parameter, &options, &optionsError)) {
+    if(!services.empty()) {
+      *error = optionsError;
+      return false;
+    }
+  }
+
+  if(options.outputFormat == OutputFormat::JAVASCRIPT) {
+    std::unique_ptr<ZeroCopyOutputStream> moduleFileStream(
+      context->Open(rootDir + "/index.js")
+    );
+    std::unique_ptr<ZeroCopyOutputStream> declarationsFileStream(
+      context->Open(rootDir + "/index.d.ts")
+    );
+    std::unique_ptr<ZeroCopyOutputStream> metadataFileStream(
+      context->Open(rootDir + "/index.metadata.json")
+    );
+    Printer printer(moduleFileStream.get(), '$');
+    Printer declarationsPrinter(declarationsFileStream.get(), '$');
+    Printer metadataPrinter(metadataFileStream.get(), '$');
+
+    PrintAngularModuleIndexJs(printer, services);
+    PrintAngularModuleIndexDeclarations(declarationsPrinter);
+    PrintAngularModuleIndexMetadata(metadataPrinter, services);
+  } else {
+    std::unique_ptr<ZeroCopyOutputStream> moduleFileStream(
+      context->Open(rootDir + "/index.ts")
+    );
+    Printer printer(moduleFileStream.get(), '$');
+
+    PrintAngularModuleIndex(printer, services);
+  }
+
+  if(services.empty()) {
+    return true;
+  }
+
+  // HedgePolicy is only emitted when some method of the group is hedged.
+  if(options.hedge) {
+    bool hasHedgedMethod = false;
+
+    for(auto service : services) {
+      hasHedgedMethod = hasHedgedMethod
+        || ServiceHasMethod(*service, options, &IsHedgedMethod);
+    }
+
+    options.hedge = hasHedgedMethod;
+  }
+
+  if(NeedsAngularRuntime(options)) {
+    std::unique_ptr<ZeroCopyOutputStream> runtimeFileStream(
+      context->Open(rootDir + "/runtime.ts")
+    );
+    Printer runtimePrinter(runtimeFileStream.get(), '$');
+
+    PrintAngularRuntime(runtimePrinter, options);
+  }
+
+  if(options.loopback) {
+    std::unique_ptr<ZeroCopyOutputStream> benchmarkFileStream(
+      context->Open(rootDir + "/loopback.bench.ts")
+    );
+    Printer benchmarkPrinter(benchmarkFileStream.get(), '$');
 
-  PrintAngularModuleIndex(printer, services);
+    PrintAngularLoopbackBenchmark(benchmarkPrinter, services, options);
+  }
 
   return true;
 }
@@ -671,86 +3312,65 @@ bool AngularGrpcCodeGenerator::Generate
     return true;
   }
 
-  vector<pair<string, string> > options;
-  ParseGeneratorParameter(parameter, &options);
-  
-  string grpcWebOutDir;
-  string jsOut;
-
-  GrpcWebImplementation grpcWebImpl = GrpcWebImplementation::NONE;
-
-  for(auto keyValue : options) {
-    const auto& key = keyValue.first;
-    const auto& value = keyValue.second;
-
-    if(key == "grpc-web") {
-      if(value == "improbable-eng") {
-        grpcWebImpl = GrpcWebImplementation::IMPROBABLE_ENG;
-      } else
-      if(value == "google") {
-        grpcWebImpl = GrpcWebImplementation::GOOGLE;
-      }
-    } else
-    if(key == "grpc-web_out") {
-      grpcWebOutDir = value;
-    } else
-    if(key == "js_out") {
-      jsOut = value;
-    } else {
-      *error = "Unknown option: " + key;
-      return false;
-    }
-  }
-
-  switch(grpcWebImpl) {
-    case GrpcWebImplementation::GOOGLE:
-    case GrpcWebImplementation::IMPROBABLE_ENG:
-      break;
-    default:
-      *error = "options: invalid grpc-web value. "
-        "Valid options are 'google' or 'improbable-eng'";
-      return false;
-  }
-
-  if(grpcWebOutDir.empty()) {
-    *error = "options: grpc-web_out is required";
-    return false;
-  }
+  GeneratorOptions options;
 
-  if(jsOut.empty()) {
-    *error = "options: js_out is required";
+  if(!ParseGeneratorOptions(parameter, &options, error)) {
     return false;
   }
 
   string filename = file->name();
   string dir = parentPath(filename);
 
-  if(grpcWebOutDir[grpcWebOutDir.size()-1] == '/') {
-    grpcWebOutDir = grpcWebOutDir.substr(1, grpcWebOutDir.size() - 1);
-  }
-
-  if(jsOut[jsOut.size()-1] == '/') {
-    jsOut = jsOut.substr(1, jsOut.size() - 1);
-  }
-
-  map<string, string> vars;
+  map<string, string> vars = GetImportPrefixVars(options);
   string package = file->package();
   vars["package"] = package;
   vars["package_dot"] = package.empty() ? "" : package + '.';
-  vars["grpc_web_import_prefix"] = grpcWebOutDir;
-  vars["web_import_prefix"] = jsOut;
 
   auto serviceCount = file->service_count();
 
   for(auto i=0; serviceCount > i; ++i) {
     auto service = file->service(i);
+    string servicePath = dir + "/" + service->name() + ".service";
+
+    if(options.outputFormat == OutputFormat::JAVASCRIPT) {
+      GeneratorOptions declarationOptions = options;
+      declarationOptions.outputFormat = OutputFormat::DECLARATIONS;
+
+      std::unique_ptr<ZeroCopyOutputStream> fileStream(
+        context->Open(servicePath + ".js")
+      );
+      std::unique_ptr<ZeroCopyOutputStream> declarationsFileStream(
+        context->Open(servicePath + ".d.ts")
+      );
+      std::unique_ptr<ZeroCopyOutputStream> metadataFileStream(
+        context->Open(servicePath + ".metadata.json")
+      );
+      Printer printer(fileStream.get(), '$');
+      Printer declarationsPrinter(declarationsFileStream.get(), '$');
+      Printer metadataPrinter(metadataFileStream.get(), '$');
+
+      PrintAngularService(vars, printer, *service, options);
+      PrintAngularService(vars, declarationsPrinter, *service, declarationOptions);
+      PrintAngularServiceMetadata(metadataPrinter, *service);
+      continue;
+    }
+
     std::unique_ptr<ZeroCopyOutputStream> fileStream(
-      context->Open(dir + "/" + service->name() + ".service.ts")
+      context->Open(servicePath + ".ts")
     );
 
     Printer printer(fileStream.get(), '$');
 
-    PrintAngularService(vars, printer, *service, grpcWebImpl);
+    PrintAngularService(vars, printer, *service, options);
+
+    if(options.loopback) {
+      std::unique_ptr<ZeroCopyOutputStream> loopbackFileStream(
+        context->Open(dir + "/" + service->name() + ".loopback.ts")
+      );
+      Printer loopbackPrinter(loopbackFileStream.get(), '$');
+
+      PrintAngularServiceLoopback(vars, loopbackPrinter, *service, options);
+    }
   }
 
   return true;